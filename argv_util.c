@@ -1,5 +1,7 @@
 #include "list.h"
 #include "argv_util.h"
+#include "parser.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,7 +15,7 @@ char** list_to_argv(list** head)
     if (head == NULL)
         return NULL;
     size = list_size(*head) + 1;
-    arr = malloc(size * sizeof(*arr));
+    arr = stats_malloc(size * sizeof(*arr));
     for (curr = *head, i = 0; curr != NULL && i < size;
          curr = curr->next, i++)
     {
@@ -110,21 +112,21 @@ int is_argv_valid(char* argv[])
     if ((position = argv_contains(argv, "&")) != -1
         && (position != argc - 1 || argc == 1))
     {
-        fprintf(stderr, "Incorrect '&' position\n");
+        report_syntax_error("Incorrect '&' position");
         return 0;
     }
     is_daemon = (position == argc - 1);
 
     if (argv_contains(argv, ">") != -1 && argv_contains(argv, ">>") != -1)
     {
-        fprintf(stderr, "Unclear redirection: mixed write/append\n");
+        report_syntax_error("Unclear redirection: mixed write/append");
         return 0;
     }
     for (i = 0; i < 3; i++)
     {
         if (argv_count_entries(argv, redirect_words[i]) > 1)
         {
-            fprintf(stderr, "Double stream redirection\n");
+            report_syntax_error("Double stream redirection");
             return 0;
         }
         position = argv_contains(argv, redirect_words[i]);
@@ -140,12 +142,12 @@ int is_argv_valid(char* argv[])
                          || !strcmp(argv[position + 2],
                                     redirect_words[(i + 2) % 3])))))
         {
-            fprintf(stderr, "Invalid redirect keyword position\n");
+            report_syntax_error("Invalid redirect keyword position");
             return 0;
         }
         if (is_keyword(argv[position + 1]))
         {
-            fprintf(stderr, "Filename is empty or is a keyword\n");
+            report_syntax_error("Filename is empty or is a keyword");
             return 0;
         }
     }
@@ -158,13 +160,13 @@ int is_single_argv_valid(char* argv[])
     argc = get_argc(argv);
     if (argc == 0)
     {
-        fprintf(stderr, "No command provided\n");
+        report_syntax_error("No command provided");
         return 0;
     }
     if (argv_contains(argv, "cd") != -1
         && (argc != 2 || is_keyword(argv[1])))
     {
-        fprintf(stderr, "Argument expected for cd\n");
+        report_syntax_error("Argument expected for cd");
         return 0;
     }
     return 1;
@@ -195,7 +197,7 @@ char*** pipe_split_argv(char* argv[])
     if (argv == NULL)
         return NULL;
     num_pipes = count_pipes(argv);
-    splitted = malloc(num_pipes * sizeof(*splitted));
+    splitted = stats_malloc(num_pipes * sizeof(*splitted));
     splitted[0] = argv;
     for (i = 1; i < num_pipes; i++)
     {
@@ -256,6 +258,10 @@ command_modifier get_command_modifier(char* argv[])
     cm.redirect_in = get_unpiped_redirect_filename(argv, "<");
     cm.redirect_out = get_unpiped_redirect_filename(argv, ">");
     cm.append = 0;
+    cm.in_fd = cm.out_fd = cm.err_fd = -1;
+    cm.timeout_ms = cm.grace_ms = -1;
+    cm.pgid = -1;
+    cm.take_terminal = 0;
     if (cm.redirect_out == NULL)
     {
         cm.redirect_out = get_unpiped_redirect_filename(argv, ">>");
@@ -264,7 +270,7 @@ command_modifier get_command_modifier(char* argv[])
     return cm;
 }
 
-char** unjunk_command(char* argv[], list* separators)
+char** unjunk_command(char* argv[], const list* separators)
 {
     int i;
     for (i = 0; argv[i] != NULL; i++)
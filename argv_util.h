@@ -8,6 +8,14 @@ typedef struct command_modifier
     char* redirect_in;
     char* redirect_out;
     int append;
+    /* installed as 0/1/2 before redirection, -1 keeps the inherited */
+    int in_fd;
+    int out_fd;
+    int err_fd;
+    long timeout_ms; /* -1 for the context's default, 0 for none */
+    long grace_ms;   /* from SIGTERM to SIGKILL, 0 for no SIGKILL */
+    int pgid;        /* -1 keeps the shell's group, 0 starts a new one */
+    int take_terminal;
 } command_modifier;
 
 char** list_to_argv(list** head);
@@ -28,6 +36,6 @@ void print_piped_argv(char*** piped_argv, int num_pipes);
 int get_unpiped_daemon(char* argv[]);
 char* get_unpiped_redirect_filename(char* argv[], char* token);
 command_modifier get_command_modifier(char* argv[]);
-char** unjunk_command(char* argv[], list* separators);
+char** unjunk_command(char* argv[], const list* separators);
 
 #endif
@@ -0,0 +1,257 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "parser.h"
+#include "plan.h"
+#include "process_util.h"
+#include "stats.h"
+
+/* "bench [-n RUNS] [-w WARMUP] [-q] [-j] cmd ..." repeats the rest of
+ * the line, the prefix words stay owned by argv */
+int strip_bench_prefix(clem_plan* plan)
+{
+    char** stage = plan->piped[0];
+    int i;
+    if (strcmp(stage[0], "bench"))
+        return 0;
+    plan->bench.runs = default_bench_runs;
+    for (i = 1; stage[i] != NULL && stage[i][0] == '-'; i++)
+    {
+        if (!strcmp(stage[i], "-q"))
+            plan->bench.quiet = 1;
+        else if (!strcmp(stage[i], "-j"))
+            plan->bench.json = 1;
+        else if (!strcmp(stage[i], "-n")
+                 && parse_count(stage[i + 1], &plan->bench.runs) == 0)
+            i++;
+        else if (!strcmp(stage[i], "-w")
+                 && parse_count(stage[i + 1], &plan->bench.warmup) == 0)
+            i++;
+        else
+            break;
+    }
+    if (stage[i] == NULL || stage[i][0] == '-' || plan->bench.runs < 1
+        || plan->modifier.is_daemon)
+    {
+        report_syntax_error("Usage: bench [-n RUNS] [-w WARMUP] [-q] [-j] "
+                            "command");
+        return -1;
+    }
+    plan->piped[0] = stage + i;
+    return 0;
+}
+
+int parse_count(const char* str, int* count)
+{
+    char* end;
+    long value;
+    if (str == NULL || *str < '0' || *str > '9')
+        return -1;
+    value = strtol(str, &end, 10);
+    if (*end != '\0' || value > max_bench_count)
+        return -1;
+    *count = value;
+    return 0;
+}
+
+double bench_sqrt(double x)
+{
+    double root = x;
+    int i;
+    if (x <= 0)
+        return 0;
+    for (i = 0; i < 64; i++) /* Newton's method, converges long before */
+        root = (root + x / root) / 2;
+    return root;
+}
+
+double timeval_ms(long sec, long usec)
+{
+    return sec * 1000.0 + usec / 1000.0;
+}
+
+int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* sorts the samples, percentiles use the nearest rank */
+void summarize_samples(double* samples, int size, bench_summary* summary)
+{
+    double sum = 0, sq_sum = 0;
+    int i;
+    qsort(samples, size, sizeof(*samples), compare_doubles);
+    for (i = 0; i < size; i++)
+        sum += samples[i];
+    summary->mean = sum / size;
+    for (i = 0; i < size; i++)
+        sq_sum += (samples[i] - summary->mean)
+            * (samples[i] - summary->mean);
+    summary->stddev = bench_sqrt(sq_sum / size);
+    summary->min = samples[0];
+    summary->max = samples[size - 1];
+    summary->p50 = samples[(size * 50 + 99) / 100 - 1];
+    summary->p90 = samples[(size * 90 + 99) / 100 - 1];
+    summary->p99 = samples[(size * 99 + 99) / 100 - 1];
+}
+
+static void print_word(FILE* out, const char* word, int json)
+{
+    for (; json && *word != '\0'; word++)
+    {
+        if (*word == '"' || *word == '\\')
+            fputc('\\', out);
+        fputc(*word, out);
+    }
+    if (!json)
+        fputs(word, out);
+}
+
+/* prints the line as it was written, not the optimizer's rewrite of it */
+void print_plan_command(FILE* out, const clem_plan* plan, int json)
+{
+    int i, j, num_pipes = plan->num_pipes;
+    char*** piped = plan->piped;
+    const command_modifier* cmd_mod = &plan->modifier;
+    if (plan->written != NULL)
+    {
+        num_pipes = plan->num_written;
+        piped = plan->written;
+        cmd_mod = &plan->written_modifier;
+    }
+    for (i = 0; i < num_pipes; i++)
+    {
+        for (j = 0; piped[i][j] != NULL; j++)
+        {
+            if (i + j > 0)
+                fputs(j == 0 ? " | " : " ", out);
+            print_word(out, piped[i][j], json);
+        }
+    }
+    if (cmd_mod->redirect_in != NULL)
+    {
+        fputs(" < ", out);
+        print_word(out, cmd_mod->redirect_in, json);
+    }
+    if (cmd_mod->redirect_out != NULL)
+    {
+        fputs(cmd_mod->append ? " >> " : " > ", out);
+        print_word(out, cmd_mod->redirect_out, json);
+    }
+}
+
+void print_bench_report(FILE* out, const clem_plan* plan,
+                        const bench_summary* wall,
+                        const bench_summary* user,
+                        const bench_summary* sys, int status)
+{
+    const bench_summary* rows[3];
+    const char* names[3];
+    int i;
+    rows[0] = wall, rows[1] = user, rows[2] = sys;
+    names[0] = "wall", names[1] = "user", names[2] = "sys";
+    if (plan->bench.json)
+    {
+        fputs("{\"command\": \"", out);
+        print_plan_command(out, plan, 1);
+        fprintf(out, "\", \"runs\": %d, \"warmup\": %d, \"status\": %d",
+                plan->bench.runs, plan->bench.warmup, status);
+        for (i = 0; i < 3; i++)
+        {
+            fprintf(out,
+                    ", \"%s_ms\": {\"min\": %.3f, \"p50\": %.3f, "
+                    "\"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, "
+                    "\"mean\": %.3f, \"stddev\": %.3f}",
+                    names[i], rows[i]->min, rows[i]->p50, rows[i]->p90,
+                    rows[i]->p99, rows[i]->max, rows[i]->mean,
+                    rows[i]->stddev);
+        }
+        fputs("}\n", out);
+        return;
+    }
+    fputs("bench: '", out);
+    print_plan_command(out, plan, 0);
+    fprintf(out, "', %d runs after %d warmup, last status %d\n",
+            plan->bench.runs, plan->bench.warmup, status);
+    fprintf(out, "%-8s %9s %9s %9s %9s %9s %9s %9s\n", "ms", "min", "p50",
+            "p90", "p99", "max", "mean", "stddev");
+    for (i = 0; i < 3; i++)
+    {
+        fprintf(out, "%-8s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                names[i], rows[i]->min, rows[i]->p50, rows[i]->p90,
+                rows[i]->p99, rows[i]->max, rows[i]->mean,
+                rows[i]->stddev);
+    }
+    if (wall->mean > 0)
+        fprintf(out, "spread: stddev is %.1f%% of the mean wall time\n",
+                100 * wall->stddev / wall->mean);
+}
+
+/* the plan was parsed once, every run goes straight to perform_command
+ * so the shell's own parsing stays out of the numbers */
+int perform_bench(clem_ctx* ctx, const clem_plan* plan,
+                  const int std_fds[3])
+{
+    clem_plan run_plan;
+    int fds[3], i, status = 0, runs = plan->bench.runs;
+    double *wall, *user, *sys;
+    bench_summary wall_sum, user_sum, sys_sum;
+    struct rusage usage;
+    struct timespec start, end;
+    FILE* out;
+    run_plan = *plan;
+    run_plan.bench.runs = 0;
+    wall = stats_malloc((size_t)runs * 3 * sizeof(*wall));
+    if (wall == NULL)
+    {
+        fprintf(stderr, "bench: cannot keep %d samples\n", runs);
+        return 1;
+    }
+    user = wall + runs;
+    sys = user + runs;
+    for (i = 0; i < 3; i++)
+        fds[i] = std_fds != NULL ? std_fds[i] : -1;
+    if (plan->bench.quiet)
+        fds[1] = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    for (i = 0; i < plan->bench.warmup; i++)
+        perform_command(ctx, &run_plan, fds, NULL);
+    for (i = 0; i < runs; i++)
+    {
+        memset(&usage, 0, sizeof(usage));
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        status = perform_command(ctx, &run_plan, fds, &usage);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        wall[i] = (end.tv_sec - start.tv_sec) * 1000.0
+            + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+        user[i]
+            = timeval_ms(usage.ru_utime.tv_sec, usage.ru_utime.tv_usec);
+        sys[i]
+            = timeval_ms(usage.ru_stime.tv_sec, usage.ru_stime.tv_usec);
+    }
+    if (plan->bench.quiet && fds[1] != -1)
+        close(fds[1]);
+    summarize_samples(wall, runs, &wall_sum);
+    summarize_samples(user, runs, &user_sum);
+    summarize_samples(sys, runs, &sys_sum);
+    free(wall);
+    out = stdout;
+    if (std_fds != NULL && std_fds[1] != -1
+        && (i = dup(std_fds[1])) != -1)
+        out = fdopen(i, "w");
+    print_bench_report(out, plan, &wall_sum, &user_sum, &sys_sum,
+                       status);
+    if (out != stdout)
+        fclose(out);
+    else
+        fflush(stdout);
+    return status;
+}
@@ -0,0 +1,40 @@
+#ifndef CLEMULATOR_BENCH_H
+#define CLEMULATOR_BENCH_H
+
+#include <stdio.h>
+
+#include "clemulator.h"
+
+enum
+{
+    default_bench_runs = 10,
+    max_bench_count = 1000000 /* runs or warmups, 24 bytes per run */
+};
+
+typedef struct bench_options
+{
+    int runs; /* 0 when the line is not a benchmark */
+    int warmup;
+    int quiet; /* discard the command's stdout */
+    int json;
+} bench_options;
+
+/* summary of one measured quantity over all runs, in milliseconds */
+typedef struct bench_summary
+{
+    double min, p50, p90, p99, max, mean, stddev;
+} bench_summary;
+
+int strip_bench_prefix(clem_plan* plan);
+int parse_count(const char* str, int* count);
+double bench_sqrt(double x);
+double timeval_ms(long sec, long usec);
+void print_plan_command(FILE* out, const clem_plan* plan, int json);
+void summarize_samples(double* samples, int size, bench_summary* summary);
+void print_bench_report(FILE* out, const clem_plan* plan,
+                        const bench_summary* wall,
+                        const bench_summary* user,
+                        const bench_summary* sys, int status);
+int perform_bench(clem_ctx* ctx, const clem_plan* plan,
+                  const int std_fds[3]);
+#endif
@@ -0,0 +1,57 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* runs a command and writes "wall_us maxrss_kb exit_code" to a file,
+ * stdin/stdout/stderr are passed through to the command */
+int main(int argc, char* argv[])
+{
+    int pid, status;
+    long wall_us;
+    struct timeval start, end;
+    struct rusage usage;
+    FILE* result;
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s RESULT_FILE command [args]\n", argv[0]);
+        return 2;
+    }
+    gettimeofday(&start, NULL);
+    pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        return 2;
+    }
+    if (!pid)
+    {
+        execvp(argv[2], argv + 2);
+        perror(argv[2]);
+        exit(127);
+    }
+    if (wait4(pid, &status, 0, &usage) == -1)
+    {
+        perror("wait4");
+        return 2;
+    }
+    gettimeofday(&end, NULL);
+    wall_us = (end.tv_sec - start.tv_sec) * 1000000L
+        + (end.tv_usec - start.tv_usec);
+    result = fopen(argv[1], "w");
+    if (result == NULL)
+    {
+        perror(argv[1]);
+        return 2;
+    }
+    fprintf(result, "%ld %ld %d\n", wall_us, usage.ru_maxrss,
+            WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                : WEXITSTATUS(status));
+    fclose(result);
+    return 0;
+}
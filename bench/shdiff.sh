@@ -0,0 +1,178 @@
+#!/bin/sh
+# Differential run of a command corpus through clemulator.out (batch mode)
+# and /bin/sh. Every line runs in a fresh scratch directory for both
+# shells; stdout, exit code and the resulting files are compared. Both
+# shells read the commands from a file, the commands get an empty stdin.
+#
+# usage: shdiff.sh [-u] CORPUS RESULT_TSV [BASELINE_TSV]
+#   -u  store RESULT_TSV as BASELINE_TSV instead of comparing against it
+#
+# Per line the table holds the best wall time of $REPS runs, peak RSS of
+# the shell and its children, and the syscall count when strace or perf
+# is available ("-" otherwise). The "makespan" row is the whole corpus
+# run as one script.
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+EMU=${EMU:-$BENCH_DIR/../clemulator.out}
+RUNSTAT=${RUNSTAT:-$BENCH_DIR/runstat}
+REPS=${REPS:-3}
+
+update=0
+if [ "$1" = "-u" ]; then
+    update=1
+    shift
+fi
+if [ $# -lt 2 ]; then
+    echo "usage: $0 [-u] CORPUS RESULT_TSV [BASELINE_TSV]" >&2
+    exit 2
+fi
+corpus=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+result=$2
+baseline=${3:-$BENCH_DIR/baseline.tsv}
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# fresh directory with the files the corpus relies on
+seed_dir()
+{
+    rm -rf "$1"
+    mkdir -p "$1"
+    printf 'banana\napple\ncherry\nbanana\nblueberry\n' > "$1/input.txt"
+    printf 'first\n' > "$1/log.txt"
+}
+
+# name and contents of every file left in a directory
+dump_dir()
+{
+    (cd "$1" && for f in *; do
+        echo "== $f"
+        cat "$f"
+    done)
+}
+
+count_syscalls()
+{
+    # count_syscalls DIR command [args] < stdin
+    dir=$1
+    shift
+    if command -v strace > /dev/null 2>&1; then
+        (cd "$dir" && strace -f -c -o "$work/strace" "$@" > /dev/null 2>&1)
+        awk '$NF == "total" { print $4 }' "$work/strace"
+    elif command -v perf > /dev/null 2>&1; then
+        (cd "$dir" && perf stat -x, -e raw_syscalls:sys_enter \
+            -o "$work/perf" "$@" > /dev/null 2>&1)
+        awk -F, '/raw_syscalls/ { print $1 }' "$work/perf"
+    else
+        echo "-"
+    fi
+}
+
+# run_one NAME LINE: best-of-$REPS stats in $work/NAME.best, output and
+# files of the last run in $work/NAME.out and $work/NAME.files
+run_one()
+{
+    name=$1
+    line=$2
+    best=""
+    rep=0
+    printf '%s\n' "$line" > "$work/line"
+    while [ $rep -lt "$REPS" ]; do
+        seed_dir "$work/$name"
+        if [ "$name" = emu ]; then
+            (cd "$work/$name" && "$RUNSTAT" "$work/$name.stat" \
+                "$EMU" -b "$work/line" < /dev/null \
+                > "$work/$name.out" 2> /dev/null)
+        else
+            (cd "$work/$name" && "$RUNSTAT" "$work/$name.stat" \
+                /bin/sh -c "$line" < /dev/null \
+                > "$work/$name.out" 2> /dev/null)
+        fi
+        if [ -z "$best" ] || [ "$(cut -d' ' -f1 "$work/$name.stat")" \
+            -lt "$(echo "$best" | cut -d' ' -f1)" ]; then
+            best=$(cat "$work/$name.stat")
+        fi
+        rep=$((rep + 1))
+    done
+    echo "$best" > "$work/$name.best"
+    dump_dir "$work/$name" > "$work/$name.files"
+    seed_dir "$work/$name"
+    if [ "$name" = emu ]; then
+        count_syscalls "$work/$name" "$EMU" -b "$work/line" \
+            < /dev/null > "$work/$name.sys"
+    else
+        count_syscalls "$work/$name" /bin/sh -c "$line" \
+            < /dev/null > "$work/$name.sys"
+    fi
+}
+
+printf 'line\tmatch\temu_us\tsh_us\temu_rss_kb\tsh_rss_kb' > "$result"
+printf '\temu_syscalls\tsh_syscalls\temu_rc\tsh_rc\tcommand\n' >> "$result"
+
+n=0
+mismatches=0
+while IFS= read -r line; do
+    n=$((n + 1))
+    run_one emu "$line"
+    run_one sh "$line"
+    read -r emu_us emu_rss emu_rc < "$work/emu.best"
+    read -r sh_us sh_rss sh_rc < "$work/sh.best"
+    match=1
+    if [ "$emu_rc" != "$sh_rc" ] \
+        || ! cmp -s "$work/emu.out" "$work/sh.out" \
+        || ! cmp -s "$work/emu.files" "$work/sh.files"; then
+        match=0
+        mismatches=$((mismatches + 1))
+    fi
+    printf '%d\t%d\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n' "$n" "$match" \
+        "$emu_us" "$sh_us" "$emu_rss" "$sh_rss" "$(cat "$work/emu.sys")" \
+        "$(cat "$work/sh.sys")" "$emu_rc" "$sh_rc" "$line" >> "$result"
+done < "$corpus"
+
+seed_dir "$work/emu"
+seed_dir "$work/sh"
+(cd "$work/emu" && "$RUNSTAT" "$work/emu.stat" "$EMU" -b "$corpus" \
+    < /dev/null > /dev/null 2>&1)
+(cd "$work/sh" && "$RUNSTAT" "$work/sh.stat" /bin/sh "$corpus" \
+    < /dev/null > /dev/null 2>&1)
+read -r emu_us emu_rss emu_rc < "$work/emu.stat"
+read -r sh_us sh_rss sh_rc < "$work/sh.stat"
+printf 'makespan\t-\t%s\t%s\t%s\t%s\t-\t-\t%s\t%s\t%s\n' "$emu_us" \
+    "$sh_us" "$emu_rss" "$sh_rss" "$emu_rc" "$sh_rc" \
+    "$(basename "$corpus")" >> "$result"
+
+column -t -s "$(printf '\t')" "$result" 2> /dev/null || cat "$result"
+echo "$n lines, $mismatches behave differently from /bin/sh"
+
+if [ $update -eq 1 ]; then
+    cp "$result" "$baseline"
+    echo "baseline stored in $baseline"
+    exit 0
+fi
+if [ ! -f "$baseline" ]; then
+    echo "no baseline yet, run with -u to store one"
+    exit 0
+fi
+
+# lines that used to match /bin/sh and no longer do are regressions,
+# latency is only reported since it is too noisy to gate on
+awk -F '\t' '
+    NR == FNR { if (FNR > 1) { base_match[$1] = $2; base_us[$1] = $3 }
+                next }
+    FNR == 1 { next }
+    {
+        if (base_match[$1] == 1 && $2 == 0) {
+            printf "REGRESSION line %s: %s\n", $1, $11
+            bad++
+        }
+        if ($1 == "makespan")
+            printf "makespan %s us, baseline %s us\n", $3, base_us[$1]
+        else {
+            now += $3
+            was += base_us[$1]
+        }
+    }
+    END {
+        printf "sum of per-line latency %d us, baseline %d us\n", now, was
+        exit bad ? 1 : 0
+    }' "$baseline" "$result"
@@ -0,0 +1,105 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clemulator.h"
+#include "context.h"
+#include "deadline.h"
+#include "plan.h"
+#include "process_util.h"
+
+clem_ctx* clem_ctx_new()
+{
+    return context_init();
+}
+
+void clem_ctx_free(clem_ctx* ctx)
+{
+    context_free(ctx);
+}
+
+void clem_ctx_set_flags(clem_ctx* ctx, int flags)
+{
+    ctx->flags = flags;
+}
+
+void clem_ctx_set_timeout(clem_ctx* ctx, long timeout_ms, long grace_ms)
+{
+    ctx->default_timeout_ms = timeout_ms;
+    ctx->default_grace_ms = grace_ms >= 0 ? grace_ms : default_grace_ms;
+}
+
+int clem_parse_duration(const char* str, long* ms)
+{
+    return parse_duration(str, ms);
+}
+
+int clem_timer_fd(clem_ctx* ctx)
+{
+    return ctx->timer_fd;
+}
+
+void clem_dispatch(clem_ctx* ctx)
+{
+    dispatch_deadlines(ctx);
+}
+
+int clem_reap(clem_ctx* ctx)
+{
+    return reap_background_jobs(ctx);
+}
+
+clem_plan* clem_parse(clem_ctx* ctx, const char* line)
+{
+    return parse_plan(line, ctx != NULL ? ctx->flags : 0);
+}
+
+void clem_plan_free(clem_plan* plan)
+{
+    free_plan(plan);
+}
+
+int clem_run(clem_ctx* ctx, const clem_plan* plan, int in_fd, int out_fd,
+             int err_fd, clem_result* result)
+{
+    int std_fds[3];
+    clem_result local;
+    if (ctx == NULL || plan == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (result == NULL)
+        result = &local;
+    std_fds[0] = in_fd, std_fds[1] = out_fd, std_fds[2] = err_fd;
+    memset(&result->rusage, 0, sizeof(result->rusage));
+    result->status = perform_command(ctx, plan, std_fds, &result->rusage);
+    return result->status;
+}
+
+/* the plan runs in a child of its own, so the pidfd tracks the whole
+ * pipeline and its exit code is the plan's status */
+int clem_spawn(clem_ctx* ctx, const clem_plan* plan, int in_fd,
+               int out_fd, int err_fd, int* pidfd)
+{
+    int pid;
+    if (ctx == NULL || plan == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    pid = fork();
+    if (pid == -1)
+        return -1;
+    if (pid == 0)
+    {
+        ctx = context_for_child(ctx);
+        _exit(clem_run(ctx, plan, in_fd, out_fd, err_fd, NULL));
+    }
+    if (pidfd != NULL)
+        *pidfd = open_pidfd(pid);
+    return pid;
+}
@@ -0,0 +1,67 @@
+#ifndef CLEMULATOR_H
+#define CLEMULATOR_H
+
+/* Embeddable API of the emulator (libclemulator).
+ *
+ * A context owns the background jobs started through it and has no
+ * shared state with other contexts, so every thread can run command
+ * lines through its own context. The process-wide parts are the ones a
+ * real shell shares too: the working directory changed by "cd" and the
+ * counters printed by "stats". */
+
+#include <sys/resource.h>
+
+typedef struct clem_ctx clem_ctx;
+typedef struct clem_plan clem_plan;
+
+/* clem_ctx_set_flags bits */
+enum
+{
+    clem_no_pipe_optimizer = 1, /* run pipelines exactly as written */
+    clem_log_rewrites = 2,      /* report optimizer rewrites on stderr */
+    clem_cache_appends = 4      /* keep ">>" targets open between runs */
+};
+
+typedef struct clem_result
+{
+    int status;           /* exit code of the last stage */
+    struct rusage rusage; /* summed over all stages */
+} clem_result;
+
+clem_ctx* clem_ctx_new();
+/* reaps finished background jobs and waits for the ones under a
+ * deadline until it is enforced, other running ones are left alone */
+void clem_ctx_free(clem_ctx* ctx);
+/* the optimizer bits apply to plans parsed afterwards */
+void clem_ctx_set_flags(clem_ctx* ctx, int flags);
+/* deadline for commands not run under the "timeout" prefix, 0 or -1
+ * for none; on expiry the pipeline's process group gets SIGTERM and,
+ * after grace_ms (0 for never, -1 for the default), SIGKILL, and the
+ * command's status is 124 */
+void clem_ctx_set_timeout(clem_ctx* ctx, long timeout_ms, long grace_ms);
+/* "10", "1.5s", "2m", "1h" or "1d" in milliseconds, -1 if malformed */
+int clem_parse_duration(const char* str, long* ms);
+/* readable when a deadline of a background job is due, -1 while the
+ * context has never had one; clem_dispatch then signals the jobs */
+int clem_timer_fd(clem_ctx* ctx);
+void clem_dispatch(clem_ctx* ctx);
+/* reaps finished background jobs, returns how many are still running */
+int clem_reap(clem_ctx* ctx);
+
+/* tokenizes and validates a line, NULL on a syntax error (reported on
+ * stderr); the plan is immutable and may be run any number of times */
+clem_plan* clem_parse(clem_ctx* ctx, const char* line);
+void clem_plan_free(clem_plan* plan);
+
+/* runs a plan with the given fds as stdin/stdout/stderr of the commands
+ * (-1 keeps the caller's own), returns the exit status or -1 on failure;
+ * background ("&") plans return 0 as soon as the jobs are started */
+int clem_run(clem_ctx* ctx, const clem_plan* plan, int in_fd, int out_fd,
+             int err_fd, clem_result* result);
+
+/* starts a plan without waiting, returns the pid to wait for and stores
+ * a pidfd that becomes readable on completion (-1 if the kernel has no
+ * pidfd_open), or returns -1 on failure */
+int clem_spawn(clem_ctx* ctx, const clem_plan* plan, int in_fd,
+               int out_fd, int err_fd, int* pidfd);
+#endif
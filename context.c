@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "function.h"
+#include "plan.h"
+#include "redirect_cache.h"
+#include "stats.h"
+
+clem_ctx* context_init()
+{
+    clem_ctx* ctx;
+    int i;
+    ctx = stats_malloc(sizeof(*ctx));
+    ctx->bg_count = 0;
+    ctx->flags = 0;
+    ctx->bg_cap = default_jobs_cap;
+    ctx->jobs = stats_malloc(ctx->bg_cap * sizeof(*ctx->jobs));
+    ctx->num_deadlines = 0;
+    ctx->deadlines_cap = default_deadlines_cap;
+    ctx->deadlines
+        = stats_malloc(ctx->deadlines_cap * sizeof(*ctx->deadlines));
+    ctx->timer_fd = -1;
+    ctx->default_timeout_ms = -1;
+    ctx->default_grace_ms = default_grace_ms;
+    ctx->num_functions = 0;
+    ctx->functions_cap = default_functions_cap;
+    ctx->functions
+        = stats_malloc(ctx->functions_cap * sizeof(*ctx->functions));
+    ctx->call_depth = 0;
+    for (i = 0; i < redirect_cache_size; i++)
+        ctx->redirects[i].path = NULL;
+    ctx->redirect_clock = 0;
+    return ctx;
+}
+
+/* a deadline is a promise to stop the job, so the jobs under one are
+ * waited for, with the deadline enforced, before the context goes */
+void finish_deadline_jobs(clem_ctx* ctx)
+{
+    struct pollfd* fds;
+    int i, size, no_pidfd;
+    while (reap_background_jobs(ctx) > 0 && ctx->num_deadlines > 0)
+    {
+        fds = stats_malloc((ctx->bg_count + 1) * sizeof(*fds));
+        fds[0].fd = ctx->timer_fd;
+        fds[0].events = POLLIN;
+        size = 1;
+        no_pidfd = 0;
+        for (i = 0; i < ctx->bg_count; i++)
+        {
+            if (ctx->jobs[i].pgid == -1)
+                continue;
+            fds[size].fd = open_pidfd(ctx->jobs[i].pid);
+            fds[size].events = POLLIN;
+            no_pidfd |= fds[size].fd == -1;
+            size++;
+        }
+        poll(fds, size, no_pidfd ? 10 : -1);
+        for (i = 1; i < size; i++)
+        {
+            if (fds[i].fd != -1)
+                close(fds[i].fd);
+        }
+        free(fds);
+    }
+}
+
+/* for a forked child running on behalf of parent: the settings and the
+ * functions carry over, the jobs, deadlines and cached fds stay the
+ * parent's to handle */
+clem_ctx* context_for_child(const clem_ctx* parent)
+{
+    clem_ctx* ctx;
+    int i;
+    ctx = context_init();
+    ctx->flags = parent->flags;
+    ctx->default_timeout_ms = parent->default_timeout_ms;
+    ctx->default_grace_ms = parent->default_grace_ms;
+    for (i = 0; i < parent->num_functions; i++)
+        define_function(ctx, parent->functions[i].function);
+    return ctx;
+}
+
+void context_free(clem_ctx* ctx)
+{
+    int i;
+    if (ctx == NULL)
+        return;
+    finish_deadline_jobs(ctx);
+    for (i = 0; i < ctx->num_functions; i++)
+        free_plan(ctx->functions[i].function);
+    free(ctx->functions);
+    flush_redirect_cache(ctx);
+    if (ctx->timer_fd != -1)
+        close(ctx->timer_fd);
+    free(ctx->deadlines);
+    free(ctx->jobs);
+    free(ctx);
+}
+
+void add_background_job(clem_ctx* ctx, int pid, int pgid)
+{
+    if (ctx->bg_count == ctx->bg_cap)
+    {
+        ctx->bg_cap *= 2;
+        ctx->jobs
+            = stats_realloc(ctx->jobs, ctx->bg_cap * sizeof(*ctx->jobs));
+    }
+    ctx->jobs[ctx->bg_count].pid = pid;
+    ctx->jobs[ctx->bg_count].pgid = pgid;
+    ctx->bg_count++;
+}
+
+int is_group_running(clem_ctx* ctx, int pgid)
+{
+    int i;
+    for (i = 0; i < ctx->bg_count; i++)
+    {
+        if (ctx->jobs[i].pgid == pgid)
+            return 1;
+    }
+    return 0;
+}
+
+/* replaces the process-wide SIGCHLD handler: only our own children are
+ * waited for, so other contexts and the embedding program keep theirs */
+int reap_background_jobs(clem_ctx* ctx)
+{
+    int i = 0, pgid;
+    dispatch_deadlines(ctx);
+    while (i < ctx->bg_count)
+    {
+        if (waitpid(ctx->jobs[i].pid, NULL, WNOHANG) == 0)
+        {
+            i++;
+            continue;
+        }
+        pgid = ctx->jobs[i].pgid;
+        ctx->jobs[i] = ctx->jobs[--ctx->bg_count];
+        if (pgid != -1 && !is_group_running(ctx, pgid))
+            remove_deadline(ctx, pgid);
+    }
+    return ctx->bg_count;
+}
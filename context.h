@@ -0,0 +1,48 @@
+#ifndef CLEMULATOR_CONTEXT_H
+#define CLEMULATOR_CONTEXT_H
+
+#include "clemulator.h"
+#include "deadline.h"
+#include "process_util.h"
+#include "redirect_cache.h"
+
+enum
+{
+    default_jobs_cap = 8
+};
+
+typedef struct background_job
+{
+    int pid;
+    int pgid; /* -1 unless the job runs under a deadline */
+} background_job;
+
+/* everything a running shell keeps between command lines */
+struct clem_ctx
+{
+    background_job* jobs; /* background children not reaped yet */
+    int bg_count;
+    int bg_cap;
+    int flags; /* clem_ctx_set_flags bits */
+    deadline* deadlines; /* min-heap by due time */
+    int num_deadlines;
+    int deadlines_cap;
+    int timer_fd; /* armed for deadlines[0], -1 until first needed */
+    long default_timeout_ms; /* -1 for none */
+    long default_grace_ms;
+    builtin* functions; /* defined with "name() { ... }" */
+    int num_functions;
+    int functions_cap;
+    int call_depth; /* of the function calls running now */
+    cached_redirect redirects[redirect_cache_size];
+    unsigned long redirect_clock; /* last_used of the newest entry */
+};
+
+clem_ctx* context_init();
+clem_ctx* context_for_child(const clem_ctx* parent);
+void context_free(clem_ctx* ctx);
+void add_background_job(clem_ctx* ctx, int pid, int pgid);
+int is_group_running(clem_ctx* ctx, int pgid);
+int reap_background_jobs(clem_ctx* ctx);
+void finish_deadline_jobs(clem_ctx* ctx);
+#endif
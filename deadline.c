@@ -0,0 +1,261 @@
+#define _GNU_SOURCE /* wait4, syscall */
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "deadline.h"
+#include "process_util.h"
+#include "stats.h"
+
+/* Deadlines of a context live in one binary min-heap ordered by due
+ * time, and a single timerfd is armed for the earliest of them, so the
+ * number of pending deadlines costs nothing while nothing expires. */
+
+long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* "1.5", "30s", "2m", "1h" or "1d", like coreutils timeout; as there,
+ * 0 stands for no timeout, and no KILL when used as the grace period */
+int parse_duration(const char* str, long* ms)
+{
+    char* end;
+    double value;
+    if (str == NULL)
+        return -1;
+    value = strtod(str, &end);
+    if (end == str || !(value >= 0)) /* NaN compares false */
+        return -1;
+    if (*end != '\0' && end[1] != '\0')
+        return -1;
+    switch (*end)
+    {
+    case '\0':
+    case 's':
+        break;
+    case 'm':
+        value *= 60;
+        break;
+    case 'h':
+        value *= 60 * 60;
+        break;
+    case 'd':
+        value *= 24 * 60 * 60;
+        break;
+    default:
+        return -1;
+    }
+    if (value * 1000 > LONG_MAX / 2) /* infinity too */
+        return -1;
+    *ms = (long)(value * 1000 + 0.5);
+    if (*ms == 0 && value > 0)
+        *ms = 1; /* too short to round down to "none" */
+    return 0;
+}
+
+int open_pidfd(int pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void swap_deadlines(deadline* heap, int i, int j)
+{
+    deadline tmp;
+    tmp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = tmp;
+}
+
+void sift_deadline(deadline* heap, int size, int i)
+{
+    int child;
+    while (i > 0 && heap[i].due_ms < heap[(i - 1) / 2].due_ms)
+    {
+        swap_deadlines(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while ((child = 2 * i + 1) < size)
+    {
+        if (child + 1 < size
+            && heap[child + 1].due_ms < heap[child].due_ms)
+            child++;
+        if (heap[i].due_ms <= heap[child].due_ms)
+            break;
+        swap_deadlines(heap, i, child);
+        i = child;
+    }
+}
+
+void add_deadline(clem_ctx* ctx, int pgid, long timeout_ms, long grace_ms)
+{
+    deadline* d;
+    if (ctx->timer_fd == -1)
+        ctx->timer_fd
+            = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (ctx->num_deadlines == ctx->deadlines_cap)
+    {
+        ctx->deadlines_cap *= 2;
+        ctx->deadlines = stats_realloc(
+            ctx->deadlines, ctx->deadlines_cap * sizeof(*ctx->deadlines));
+    }
+    d = &ctx->deadlines[ctx->num_deadlines++];
+    d->due_ms = monotonic_ms() + timeout_ms;
+    d->grace_ms = grace_ms;
+    d->pgid = pgid;
+    d->signals_sent = 0;
+    sift_deadline(ctx->deadlines, ctx->num_deadlines,
+                  ctx->num_deadlines - 1);
+    arm_deadline_timer(ctx);
+}
+
+/* returns the signals sent to the group so far, -1 if it had none */
+int remove_deadline(clem_ctx* ctx, int pgid)
+{
+    int i, sent;
+    for (i = 0; i < ctx->num_deadlines; i++)
+    {
+        if (ctx->deadlines[i].pgid == pgid)
+            break;
+    }
+    if (i == ctx->num_deadlines)
+        return -1;
+    sent = ctx->deadlines[i].signals_sent;
+    ctx->deadlines[i] = ctx->deadlines[--ctx->num_deadlines];
+    if (i < ctx->num_deadlines)
+        sift_deadline(ctx->deadlines, ctx->num_deadlines, i);
+    arm_deadline_timer(ctx);
+    return sent;
+}
+
+void arm_deadline_timer(clem_ctx* ctx)
+{
+    struct itimerspec spec;
+    long due;
+    if (ctx->timer_fd == -1)
+        return;
+    memset(&spec, 0, sizeof(spec)); /* disarms */
+    if (ctx->num_deadlines > 0 && ctx->deadlines[0].due_ms != LONG_MAX)
+    {
+        due = ctx->deadlines[0].due_ms;
+        spec.it_value.tv_sec = due / 1000;
+        spec.it_value.tv_nsec = due % 1000 * 1000000L;
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+            spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(ctx->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/* SIGTERM on expiry, SIGKILL after the grace period; the entry stays
+ * until its owner removes it once the group has been waited for */
+void dispatch_deadlines(clem_ctx* ctx)
+{
+    unsigned long expirations;
+    long now;
+    deadline* top;
+    if (ctx->timer_fd == -1)
+        return;
+    while (read(ctx->timer_fd, &expirations, sizeof(expirations)) > 0)
+        ;
+    now = monotonic_ms();
+    while (ctx->num_deadlines > 0 && ctx->deadlines[0].due_ms <= now)
+    {
+        top = &ctx->deadlines[0];
+        if (top->signals_sent == 0)
+        {
+            kill(-top->pgid, SIGTERM);
+            kill(-top->pgid, SIGCONT); /* stopped jobs see it too */
+            top->due_ms
+                = top->grace_ms > 0 ? now + top->grace_ms : LONG_MAX;
+        }
+        else
+        {
+            kill(-top->pgid, SIGKILL);
+            top->due_ms = LONG_MAX;
+        }
+        top->signals_sent++;
+        sift_deadline(ctx->deadlines, ctx->num_deadlines, 0);
+    }
+    arm_deadline_timer(ctx);
+}
+
+/* waits for a process group led by pids[0], under a deadline unless
+ * timeout_ms is 0 or -1; the loop sleeps in poll() on the pidfds and the
+ * context's timerfd, so expiry of any deadline of the context is
+ * handled while we wait */
+int wait_pids_with_deadline(clem_ctx* ctx, int* pids, int size,
+                            long timeout_ms, long grace_ms,
+                            struct rusage* usage)
+{
+    struct pollfd* fds;
+    struct rusage child_usage;
+    int i, left = 0, no_pidfd = 0, wstatus, status = 0, pgid = -1, got;
+    if (timeout_ms > 0)
+    {
+        pgid = pids[0];
+        add_deadline(ctx, pgid, timeout_ms, grace_ms);
+    }
+    fds = stats_malloc((size + 1) * sizeof(*fds));
+    fds[0].fd = ctx->timer_fd;
+    fds[0].events = POLLIN;
+    for (i = 0; i < size; i++)
+    {
+        fds[i + 1].fd = pids[i] == -1 ? -1 : open_pidfd(pids[i]);
+        fds[i + 1].events = POLLIN;
+        no_pidfd |= pids[i] != -1 && fds[i + 1].fd == -1;
+        left += pids[i] != -1;
+    }
+    while (left > 0)
+    {
+        /* without pidfds (pre-5.3 kernels) fall back to polling */
+        if (poll(fds, size + 1, no_pidfd ? 10 : -1) == -1
+            && errno != EINTR)
+            break;
+        if (fds[0].revents & POLLIN)
+            dispatch_deadlines(ctx);
+        for (i = 0; i < size; i++)
+        {
+            if (pids[i] == -1
+                || (fds[i + 1].fd != -1 && !(fds[i + 1].revents & POLLIN)))
+                continue;
+            got = wait4(pids[i], &wstatus, WNOHANG, &child_usage);
+            if (got == 0 || (got == -1 && errno == EINTR))
+                continue;
+            /* -1 (ECHILD): reaped behind our back, SIGCHLD ignored or
+             * another thread, done as far as we can tell, as in
+             * wait_child */
+            if (got > 0 && usage != NULL)
+                add_rusage(usage, &child_usage);
+            if (i == size - 1)
+                status = got > 0 ? decode_wait_status(wstatus) : 1;
+            if (fds[i + 1].fd != -1)
+                close(fds[i + 1].fd);
+            fds[i + 1].fd = -1;
+            pids[i] = -1;
+            left--;
+        }
+    }
+    free(fds);
+    if (pgid != -1 && remove_deadline(ctx, pgid) > 0)
+        return status_timed_out;
+    return status;
+}
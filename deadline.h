@@ -0,0 +1,34 @@
+#ifndef CLEMULATOR_DEADLINE_H
+#define CLEMULATOR_DEADLINE_H
+
+#include <sys/resource.h>
+
+#include "clemulator.h"
+
+enum
+{
+    default_grace_ms = 2000, /* between SIGTERM and SIGKILL */
+    default_deadlines_cap = 8,
+    status_timed_out = 124 /* same as coreutils timeout */
+};
+
+/* a process group to signal once due_ms (CLOCK_MONOTONIC) has passed */
+typedef struct deadline
+{
+    long due_ms;
+    long grace_ms;
+    int pgid;
+    int signals_sent; /* 0, 1 after SIGTERM, 2 after SIGKILL */
+} deadline;
+
+long monotonic_ms();
+int parse_duration(const char* str, long* ms);
+int open_pidfd(int pid);
+void add_deadline(clem_ctx* ctx, int pgid, long timeout_ms, long grace_ms);
+int remove_deadline(clem_ctx* ctx, int pgid);
+void arm_deadline_timer(clem_ctx* ctx);
+void dispatch_deadlines(clem_ctx* ctx);
+int wait_pids_with_deadline(clem_ctx* ctx, int* pids, int size,
+                            long timeout_ms, long grace_ms,
+                            struct rusage* usage);
+#endif
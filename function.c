@@ -0,0 +1,359 @@
+#define _POSIX_C_SOURCE 200809L /* O_CLOEXEC */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "argv_util.h"
+#include "context.h"
+#include "function.h"
+#include "parser.h"
+#include "plan.h"
+#include "process_util.h"
+#include "stats.h"
+#include "string_util.h"
+
+static const char* skip_spaces(const char* str)
+{
+    while (isspace((unsigned char)*str))
+        str++;
+    return str;
+}
+
+/* "name() { body }" on one line, the body without its braces */
+int split_definition(const char* line, const char** name, int* name_len,
+                     const char** body, int* body_len)
+{
+    const char* end;
+    line = skip_spaces(line);
+    *name = line;
+    if (!isalpha((unsigned char)*line) && *line != '_')
+        return 0;
+    while (isalnum((unsigned char)*line) || *line == '_' || *line == '-')
+        line++;
+    *name_len = line - *name;
+    line = skip_spaces(line);
+    if (*line != '(')
+        return 0;
+    line = skip_spaces(line + 1);
+    if (*line != ')')
+        return 0;
+    line = skip_spaces(line + 1);
+    if (*line != '{')
+        return 0;
+    *body = line + 1;
+    end = *body + strlen(*body);
+    while (end > *body && isspace((unsigned char)end[-1]))
+        end--;
+    if (end == *body || end[-1] != '}')
+        return 0;
+    *body_len = end - 1 - *body;
+    return 1;
+}
+
+int is_function_definition(const char* line)
+{
+    const char *name, *body;
+    int name_len, body_len;
+    return line != NULL
+        && split_definition(line, &name, &name_len, &body, &body_len);
+}
+
+static char* copy_span(const char* str, int len)
+{
+    char* copy;
+    copy = stats_malloc(len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/* parses every ';'-separated command of the body now, so a call only
+ * substitutes the arguments into ready plans */
+static int parse_body_command(clem_plan* def, const char* str, int len,
+                              int flags)
+{
+    clem_plan* cmd;
+    char* text;
+    text = copy_span(str, len);
+    cmd = parse_plan(text, flags);
+    free(text);
+    if (cmd == NULL)
+        return -1;
+    if (cmd->num_pipes == 0 && cmd->function_name == NULL)
+    {
+        free_plan(cmd); /* nothing between two ';' */
+        return 0;
+    }
+    def->body = stats_realloc(def->body,
+                              (def->body_len + 1) * sizeof(*def->body));
+    def->body[def->body_len++] = cmd;
+    return 0;
+}
+
+clem_plan* parse_function_definition(const char* line, int flags)
+{
+    const char *name, *body;
+    int name_len, body_len, i, start = 0, quoted = 0;
+    clem_plan* def;
+    split_definition(line, &name, &name_len, &body, &body_len);
+    def = new_plan();
+    def->function_name = copy_span(name, name_len);
+    if (find_builtin(NULL, def->function_name) != NULL)
+    {
+        report_syntax_error("Cannot redefine a builtin");
+        free_plan(def);
+        return NULL;
+    }
+    for (i = 0; i <= body_len; i++)
+    {
+        if (i < body_len && body[i] == '"')
+            quoted = !quoted;
+        if (i < body_len && (body[i] != ';' || quoted))
+            continue;
+        if (parse_body_command(def, body + start, i - start, flags) == -1)
+        {
+            free_plan(def);
+            return NULL;
+        }
+        start = i + 1;
+    }
+    if (def->body_len == 0)
+    {
+        report_syntax_error("Function body is empty");
+        free_plan(def);
+        return NULL;
+    }
+    return def;
+}
+
+/* functions are the part of the builtin table that belongs to the
+ * context, a redefinition replaces the body for later calls */
+int define_function(clem_ctx* ctx, const clem_plan* def)
+{
+    builtin* entry = NULL;
+    clem_plan* old;
+    int i;
+    for (i = 0; i < ctx->num_functions && entry == NULL; i++)
+    {
+        if (!strcmp(ctx->functions[i].name, def->function_name))
+            entry = &ctx->functions[i];
+    }
+    if (entry == NULL)
+    {
+        if (ctx->num_functions == ctx->functions_cap)
+        {
+            ctx->functions_cap *= 2;
+            ctx->functions = stats_realloc(
+                ctx->functions,
+                ctx->functions_cap * sizeof(*ctx->functions));
+        }
+        entry = &ctx->functions[ctx->num_functions++];
+        entry->function = NULL;
+    }
+    old = entry->function;
+    entry->function = retain_plan(def);
+    free_plan(old); /* after the retain, def may be the same plan */
+    entry->name = entry->function->function_name;
+    entry->handler = NULL;
+    return 0;
+}
+
+char* copy_word(const char* word)
+{
+    return copy_span(word, strlen(word));
+}
+
+static char* append_value(char* str, const char* value, int* size,
+                          int* capacity)
+{
+    for (; *value != '\0'; value++)
+        str = update_str(str, *value, size, capacity);
+    return str;
+}
+
+/* substitutes "$1".."$9", "$#" and "$@" of a call whose argv is args,
+ * NULL when the word comes out empty */
+char* expand_word(const char* word, char* args[], int argc)
+{
+    char* res = NULL;
+    char count[16];
+    int i, j, size = 0, capacity = default_string_cap;
+    for (i = 0; word[i] != '\0'; i++)
+    {
+        if (word[i] == '$' && word[i + 1] >= '1' && word[i + 1] <= '9')
+        {
+            j = word[++i] - '0';
+            if (j < argc)
+                res = append_value(res, args[j], &size, &capacity);
+        }
+        else if (word[i] == '$' && word[i + 1] == '#')
+        {
+            sprintf(count, "%d", argc - 1);
+            res = append_value(res, count, &size, &capacity);
+            i++;
+        }
+        else if (word[i] == '$' && word[i + 1] == '@')
+        {
+            for (j = 1; j < argc; j++)
+            {
+                if (j > 1)
+                    res = update_str(res, ' ', &size, &capacity);
+                res = append_value(res, args[j], &size, &capacity);
+            }
+            i++;
+        }
+        else
+            res = update_str(res, word[i], &size, &capacity);
+    }
+    return res;
+}
+
+/* a bare "$@" stays one word per argument, empty words are dropped */
+char** expand_stage(char* stage[], char* args[], int argc)
+{
+    char** res;
+    int i, j, size = 0;
+    for (i = 0; stage[i] != NULL; i++)
+        size += strcmp(stage[i], "$@") ? 1 : argc - 1;
+    res = stats_malloc((size + 1) * sizeof(*res));
+    size = 0;
+    for (i = 0; stage[i] != NULL; i++)
+    {
+        if (!strcmp(stage[i], "$@"))
+        {
+            for (j = 1; j < argc; j++)
+                res[size++] = copy_word(args[j]);
+        }
+        else if ((res[size] = expand_word(stage[i], args, argc)) != NULL)
+            size++;
+    }
+    res[size] = NULL;
+    return res;
+}
+
+void free_stage(char* stage[])
+{
+    int i;
+    for (i = 0; stage[i] != NULL; i++)
+        free(stage[i]);
+    free(stage);
+}
+
+static char* expand_filename(const char* filename, char* args[], int argc)
+{
+    char* res;
+    if (filename == NULL)
+        return NULL;
+    res = expand_word(filename, args, argc);
+    return res != NULL ? res : copy_word("");
+}
+
+static int run_body_command(clem_ctx* ctx, clem_plan* cmd, char* args[],
+                            int argc, const int std_fds[3],
+                            struct rusage* usage)
+{
+    clem_plan call;
+    char*** piped;
+    command_modifier cmd_mod;
+    int i, status = 0, empty = 0;
+    if (cmd->function_name != NULL)
+        return define_function(ctx, cmd);
+    call = *cmd;
+    call.num_pipes = select_stages(ctx, cmd, &piped, &cmd_mod);
+    call.written = NULL;
+    call.piped = stats_malloc(call.num_pipes * sizeof(*call.piped));
+    for (i = 0; i < call.num_pipes; i++)
+    {
+        call.piped[i] = expand_stage(piped[i], args, argc);
+        empty |= call.piped[i][0] == NULL;
+    }
+    call.modifier = cmd_mod;
+    call.modifier.redirect_in
+        = expand_filename(cmd_mod.redirect_in, args, argc);
+    call.modifier.redirect_out
+        = expand_filename(cmd_mod.redirect_out, args, argc);
+    if (!empty) /* a command that was only "$1" and got no argument */
+        status = perform_command(ctx, &call, std_fds, usage);
+    for (i = 0; i < call.num_pipes; i++)
+        free_stage(call.piped[i]);
+    free(call.piped);
+    free(call.modifier.redirect_in);
+    free(call.modifier.redirect_out);
+    return status;
+}
+
+/* the call's own redirections are opened once for the whole body, which
+ * gets them as its standard descriptors */
+static int open_call_fds(command_modifier cmd_mod, int fds[3],
+                         int opened[2])
+{
+    int flags;
+    fds[0] = cmd_mod.in_fd, fds[1] = cmd_mod.out_fd,
+    fds[2] = cmd_mod.err_fd;
+    opened[0] = opened[1] = -1;
+    if (cmd_mod.redirect_in != NULL)
+    {
+        opened[0] = open(cmd_mod.redirect_in, O_RDONLY | O_CLOEXEC);
+        if (opened[0] == -1)
+        {
+            perror(cmd_mod.redirect_in);
+            return -1;
+        }
+        fds[0] = opened[0];
+    }
+    if (cmd_mod.redirect_out != NULL)
+    {
+        flags = cmd_mod.append ? O_WRONLY | O_APPEND
+                               : O_WRONLY | O_CREAT | O_TRUNC;
+        opened[1] = open(cmd_mod.redirect_out, flags | O_CLOEXEC, 0666);
+        if (opened[1] == -1)
+        {
+            perror(cmd_mod.redirect_out);
+            if (opened[0] != -1)
+                close(opened[0]);
+            return -1;
+        }
+        fds[1] = opened[1];
+    }
+    return 0;
+}
+
+/* runs the body in the calling process, only its commands fork; returns
+ * the exit code of the last one. The body may define functions, which
+ * moves the table b points into or replaces this very function, so the
+ * call holds its own reference to the plan instead of b */
+int call_function(clem_ctx* ctx, const builtin* b, char* argv[],
+                  command_modifier cmd_mod, struct rusage* usage)
+{
+    clem_plan* fn;
+    int fds[3], opened[2];
+    int i, argc, status = 0;
+    if (ctx->call_depth >= max_function_depth)
+    {
+        fprintf(stderr, "%s: maximum function nesting depth exceeded\n",
+                argv[0]);
+        return 1;
+    }
+    if (open_call_fds(cmd_mod, fds, opened) == -1)
+        return 1;
+    argc = get_argc(argv);
+    fn = retain_plan(b->function);
+    ctx->call_depth++;
+    for (i = 0; i < fn->body_len; i++)
+    {
+        status = run_body_command(ctx, fn->body[i], argv, argc, fds,
+                                  usage);
+    }
+    ctx->call_depth--;
+    free_plan(fn);
+    for (i = 0; i < 2; i++)
+    {
+        if (opened[i] != -1)
+            close(opened[i]);
+    }
+    return status;
+}
@@ -0,0 +1,27 @@
+#ifndef CLEMULATOR_FUNCTION_H
+#define CLEMULATOR_FUNCTION_H
+
+#include <sys/resource.h>
+
+#include "argv_util.h"
+#include "clemulator.h"
+#include "process_util.h"
+
+enum
+{
+    max_function_depth = 64, /* calls nested through function bodies */
+    default_functions_cap = 8
+};
+
+int split_definition(const char* line, const char** name, int* name_len,
+                     const char** body, int* body_len);
+int is_function_definition(const char* line);
+clem_plan* parse_function_definition(const char* line, int flags);
+int define_function(clem_ctx* ctx, const clem_plan* def);
+char* copy_word(const char* word);
+char* expand_word(const char* word, char* args[], int argc);
+char** expand_stage(char* stage[], char* args[], int argc);
+void free_stage(char* stage[]);
+int call_function(clem_ctx* ctx, const builtin* b, char* argv[],
+                  command_modifier cmd_mod, struct rusage* usage);
+#endif
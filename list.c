@@ -1,4 +1,5 @@
 #include "list.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,7 +7,7 @@
 list* list_init()
 {
     list* l;
-    l = malloc(sizeof(*l));
+    l = stats_malloc(sizeof(*l));
     l->next = NULL;
     l->word = NULL;
     return l;
@@ -62,7 +63,7 @@ list* list_insert(list* tail)
     return child;
 }
 
-int list_has(list* head, char* value)
+int list_has(const list* head, const char* value)
 {
     if (head == NULL)
         return 0;
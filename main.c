@@ -1,59 +1,145 @@
-#include <signal.h>
+#define _POSIX_C_SOURCE 200112L
+
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-#include "argv_util.h"
-#include "list.h"
-#include "process_util.h"
-#include "string_util.h"
-#include "parser.h"
+#include "clemulator.h"
+#include "readahead.h"
 
-char* scan_command()
+/* lets deadlines of background jobs fire while the user types; only on
+ * a terminal, where stdio never holds a line the fd no longer has */
+void wait_for_input(clem_ctx* ctx, FILE* in)
 {
-    int symbol;
-    int size = 0;
-    int capacity = default_string_cap;
-    char* command_str = NULL;
-    while ((symbol = getchar()) != EOF)
-    {
-        if (symbol == '\n')
-            return command_str;
-        command_str = update_str(command_str, symbol, &size, &capacity);
-    }
-    return command_str;
+    struct pollfd fds[2];
+    if (!isatty(fileno(in)) || clem_timer_fd(ctx) == -1)
+        return;
+    fds[0].fd = fileno(in);
+    fds[0].events = POLLIN;
+    fds[1].fd = clem_timer_fd(ctx);
+    fds[1].events = POLLIN;
+    while (poll(fds, 2, -1) > 0 && !fds[0].revents)
+        clem_dispatch(ctx);
 }
 
-void process_input(char* input, list* separators)
+int run_plan(clem_ctx* ctx, clem_plan* plan)
 {
-    list* command;
-    char** cmd_argv;
-    command_modifier modifier;
-    command = tokenize_string(input, separators);
-    cmd_argv = list_to_argv(&command);
-    if (is_argv_valid(cmd_argv))
+    clem_result result;
+    int status;
+    status = clem_run(ctx, plan, -1, -1, -1, &result);
+    clem_plan_free(plan);
+    return status;
+}
+
+/* returns the exit code of the command, 2 on a syntax error */
+int process_input(clem_ctx* ctx, char* input)
+{
+    clem_plan* plan;
+    plan = clem_parse(ctx, input);
+    if (plan == NULL)
+        return 2;
+    return run_plan(ctx, plan);
+}
+
+/* batch mode with the following lines parsed by another thread while
+ * the current one runs, returns the status of the last line */
+int run_read_ahead(clem_ctx* ctx, readahead* ra)
+{
+    readahead_line next;
+    int status = 0;
+    while (readahead_next(ra, &next))
     {
-        modifier = get_command_modifier(cmd_argv);
-        cmd_argv = unjunk_command(cmd_argv, separators);
-        perform_command(cmd_argv, modifier);
+        clem_reap(ctx);
+        if (next.plan != NULL)
+            status = run_plan(ctx, next.plan);
+        else
+        {
+            status = process_input(ctx, next.line);
+            free(next.line);
+        }
+        fflush(stdout);
     }
-    free_argv(cmd_argv);
+    readahead_stop(ra);
+    return status;
 }
 
-/* main method */
+/* main method, options:
+ * -b  run a script without prompts, exit with the status of the last
+ *     command
+ * SCRIPT  read the commands from a file instead of stdin, which is then
+ *     left to the commands
+ * -n  run pipelines exactly as written, without the optimizer
+ * -v  report pipeline rewrites on stderr
+ * -r  keep files appended to with ">>" open between commands
+ * -t DURATION  default deadline of every command */
 int main(int argc, char* argv[])
 {
     char* user_input;
-    list* separators;
-    signal(SIGCHLD, remove_zombies);
-    separators = tokenize_string(">> > < & |", NULL);
-    while (!feof(stdin))
+    clem_ctx* ctx;
+    readahead ra;
+    FILE* in = stdin;
+    int i, batch = 0, flags = 0, status = 0;
+    long timeout_ms = -1;
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-b"))
+            batch = 1;
+        else if (!strcmp(argv[i], "-n"))
+            flags |= clem_no_pipe_optimizer;
+        else if (!strcmp(argv[i], "-v"))
+            flags |= clem_log_rewrites;
+        else if (!strcmp(argv[i], "-r"))
+            flags |= clem_cache_appends;
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc
+                 && clem_parse_duration(argv[i + 1], &timeout_ms) == 0)
+            i++;
+        else if (argv[i][0] != '-' && i == argc - 1 && in == stdin)
+        {
+            if ((in = fopen(argv[i], "r")) == NULL)
+            {
+                perror(argv[i]);
+                return 2;
+            }
+            fcntl(fileno(in), F_SETFD, FD_CLOEXEC);
+        }
+        else
+        {
+            fprintf(stderr,
+                    "Usage: %s [-b] [-n] [-v] [-r] [-t DURATION] "
+                    "[SCRIPT]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    ctx = clem_ctx_new();
+    clem_ctx_set_flags(ctx, flags);
+    clem_ctx_set_timeout(ctx, timeout_ms, -1);
+    /* a terminal is left to the commands while they run, and rewrite
+     * logs have to come out next to the line they belong to */
+    if (batch && !isatty(fileno(in)) && !(flags & clem_log_rewrites)
+        && readahead_start(&ra, ctx, in) == 0)
+    {
+        status = run_read_ahead(ctx, &ra);
+        clem_ctx_free(ctx);
+        return status;
+    }
+    while (!feof(in))
     {
-        printf("::$ ");
-        user_input = scan_command();
-        process_input(user_input, separators);
+        clem_reap(ctx);
+        if (!batch)
+            printf("::$ ");
+        fflush(stdout);
+        wait_for_input(ctx, in);
+        user_input = scan_command(in);
+        if (user_input != NULL || !batch)
+            status = process_input(ctx, user_input);
         free(user_input);
     }
-    puts("\n-----");
-    list_free_no_words(separators);
-    return 0;
+    if (!batch)
+        puts("\n-----");
+    clem_ctx_free(ctx);
+    return batch ? status : 0;
 }
@@ -0,0 +1,274 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argv_util.h"
+#include "optimizer.h"
+#include "plan.h"
+#include "process_util.h"
+#include "stats.h"
+
+void log_stage(const char* prefix, char* stage[])
+{
+    int i;
+    fprintf(stderr, "%s '", prefix);
+    for (i = 0; stage[i] != NULL; i++)
+        fprintf(stderr, i ? " %s" : "%s", stage[i]);
+    fprintf(stderr, "'");
+}
+
+int is_stage(char* stage[], const char* cmd, int argc)
+{
+    return !strcmp(stage[0], cmd) && get_argc(stage) == argc;
+}
+
+int are_stages_equal(char* first[], char* second[])
+{
+    int i;
+    for (i = 0; first[i] != NULL && second[i] != NULL; i++)
+    {
+        if (strcmp(first[i], second[i]))
+            return 0;
+    }
+    return first[i] == NULL && second[i] == NULL;
+}
+
+/* filters that give the same output when applied twice in a row */
+int is_idempotent_filter(char* stage[])
+{
+    const char* sort_opts[] = { "-u", "-n", "-r", "-f", "-b", "-d",
+                                "-g", "-h", "-M", "-V", "-s", NULL };
+    const char* grep_opts[]
+        = { "-v", "-i", "-F", "-E", "-G", "-w", "-x", NULL };
+    const char** opts;
+    int i, j, patterns = 0;
+    if (!strcmp(stage[0], "uniq"))
+        return stage[1] == NULL;
+    if (!strcmp(stage[0], "sort"))
+        opts = sort_opts;
+    else if (!strcmp(stage[0], "grep"))
+        opts = grep_opts;
+    else
+        return 0;
+    for (i = 1; stage[i] != NULL; i++)
+    {
+        if (stage[i][0] != '-')
+        {
+            patterns++;
+            continue;
+        }
+        for (j = 0; opts[j] != NULL && strcmp(opts[j], stage[i]); j++)
+            ;
+        if (opts[j] == NULL)
+            return 0;
+    }
+    /* grep with a file operand ignores its stdin, sort with one too */
+    return opts == grep_opts ? patterns == 1 : patterns == 0;
+}
+
+/* "head -n N" or "head -nN", -1 for anything else */
+long head_count(char* stage[])
+{
+    char* count;
+    char* end;
+    long n;
+    if (is_stage(stage, "head", 3) && !strcmp(stage[1], "-n"))
+        count = stage[2];
+    else if (is_stage(stage, "head", 2) && !strncmp(stage[1], "-n", 2))
+        count = stage[1] + 2;
+    else
+        return -1;
+    if (!isdigit((unsigned char)count[0]))
+        return -1;
+    n = strtol(count, &end, 10);
+    return *end == '\0' ? n : -1;
+}
+
+/* "grep [-F|-E] -v PATTERN" or "grep [-F|-E] -v -e P1 -e P2 ...",
+ * returns the index of the first pattern word or 0, the mode flag is
+ * stored in mode, NULL when absent */
+int inverted_grep_patterns(char* stage[], char** mode)
+{
+    int i, start;
+    if (strcmp(stage[0], "grep") || stage[1] == NULL)
+        return 0;
+    *mode = NULL;
+    if (!strcmp(stage[1], "-F") || !strcmp(stage[1], "-E"))
+        *mode = stage[1];
+    start = *mode != NULL ? 2 : 1;
+    if (stage[start] == NULL || strcmp(stage[start], "-v"))
+        return 0;
+    start++;
+    if (stage[start] != NULL && stage[start][0] != '-'
+        && stage[start + 1] == NULL)
+        return start;
+    for (i = start; stage[i] != NULL; i += 2)
+    {
+        if (strcmp(stage[i], "-e") || stage[i + 1] == NULL)
+            return 0;
+    }
+    return i > start ? start : 0;
+}
+
+int is_same_mode(const char* first, const char* second)
+{
+    if (first == NULL || second == NULL)
+        return first == second;
+    return !strcmp(first, second);
+}
+
+/* copies the patterns of an inverted grep as "-e PATTERN" pairs */
+int append_patterns(char* grep[], int size, char* stage[], int start)
+{
+    int i;
+    for (i = start; stage[i] != NULL; i++)
+    {
+        grep[size++] = "-e";
+        if (!strcmp(stage[i], "-e"))
+            i++;
+        grep[size++] = stage[i];
+    }
+    return size;
+}
+
+void remove_stage(clem_plan* plan, int idx)
+{
+    for (; idx + 1 < plan->num_pipes; idx++)
+        plan->piped[idx] = plan->piped[idx + 1];
+    plan->num_pipes--;
+}
+
+/* "cat FILE | cmd" reads FILE directly as "cmd < FILE" */
+int fold_leading_cat(clem_plan* plan, int log)
+{
+    char** first = plan->piped[0];
+    if (plan->modifier.redirect_in != NULL || !is_stage(first, "cat", 2)
+        || first[1][0] == '-')
+        return 0;
+    if (log)
+    {
+        log_stage("pipeline: folded", first);
+        fprintf(stderr, " into '< %s'\n", first[1]);
+    }
+    plan->modifier.redirect_in = first[1];
+    remove_stage(plan, 0);
+    return 1;
+}
+
+/* a bare "cat" copies stdin to stdout, but it also hides a terminal
+ * from its neighbours, so a leading one is only dropped when stdin
+ * comes from a file anyway; a trailing one is always kept since the
+ * pipeline's status is its own */
+int drop_identity_cats(clem_plan* plan, int log)
+{
+    int i, dropped = 0;
+    for (i = 0; i < plan->num_pipes - 1 && plan->num_pipes > 1; i++)
+    {
+        if (!is_stage(plan->piped[i], "cat", 1)
+            || (i == 0 && plan->modifier.redirect_in == NULL))
+            continue;
+        if (log)
+            fprintf(stderr, "pipeline: dropped identity 'cat' stage\n");
+        remove_stage(plan, i--);
+        dropped++;
+    }
+    return dropped;
+}
+
+int merge_adjacent_filters(clem_plan* plan, int log)
+{
+    int i, merged = 0, first_start, second_start;
+    long first_n, second_n;
+    char **first, **second, **grep;
+    char *first_mode, *second_mode;
+    for (i = 0; i + 1 < plan->num_pipes; i++)
+    {
+        first = plan->piped[i];
+        second = plan->piped[i + 1];
+        if (are_stages_equal(first, second)
+            && is_idempotent_filter(first))
+        {
+            if (log)
+            {
+                log_stage("pipeline: dropped repeated", second);
+                fprintf(stderr, "\n");
+            }
+            remove_stage(plan, i + 1);
+        }
+        else if ((first_n = head_count(first)) != -1
+                 && (second_n = head_count(second)) != -1)
+        {
+            if (log)
+            {
+                log_stage("pipeline: merged", first);
+                log_stage(" and", second);
+                fprintf(stderr, "\n");
+            }
+            remove_stage(plan, first_n <= second_n ? i + 1 : i);
+        }
+        else if ((first_start
+                  = inverted_grep_patterns(first, &first_mode))
+                 && (second_start
+                     = inverted_grep_patterns(second, &second_mode))
+                 && is_same_mode(first_mode, second_mode))
+        {
+            /* not a and not b is not (a or b): grep -v -e a -e b */
+            grep = merge_inverted_greps(plan, first, first_start, second,
+                                        second_start);
+            if (log)
+            {
+                log_stage("pipeline: merged", first);
+                log_stage(" and", second);
+                log_stage(" into", grep);
+                fprintf(stderr, "\n");
+            }
+            plan->piped[i] = grep;
+            remove_stage(plan, i + 1);
+        }
+        else
+            continue;
+        merged++;
+        i--;
+    }
+    return merged;
+}
+
+/* the words stay owned by plan->argv, only the new stage array is kept
+ * in plan->extra_stages to be freed with the plan */
+char** merge_inverted_greps(clem_plan* plan, char* first[],
+                            int first_start, char* second[],
+                            int second_start)
+{
+    char** grep;
+    int size;
+    size = 2 * (get_argc(first) + get_argc(second)) + 1;
+    grep = stats_malloc(size * sizeof(*grep));
+    for (size = 0; size < first_start; size++)
+        grep[size] = first[size]; /* "grep [mode] -v" */
+    size = append_patterns(grep, size, first, first_start);
+    size = append_patterns(grep, size, second, second_start);
+    grep[size] = NULL;
+    plan->extra_stages[plan->num_extra_stages++] = grep;
+    return grep;
+}
+
+int optimize_pipeline(clem_plan* plan, int log)
+{
+    int i, rewrites = 0, changed;
+    for (i = 0; i < plan->num_pipes; i++)
+    {
+        if (find_builtin(NULL, plan->piped[i][0]) != NULL)
+            return 0; /* would run in the shell once the pipe is gone */
+    }
+    do
+    {
+        changed = 0;
+        if (plan->num_pipes > 1)
+            changed += fold_leading_cat(plan, log);
+        changed += drop_identity_cats(plan, log);
+        changed += merge_adjacent_filters(plan, log);
+        rewrites += changed;
+    } while (changed);
+    return rewrites;
+}
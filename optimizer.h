@@ -0,0 +1,23 @@
+#ifndef CLEMULATOR_OPTIMIZER_H
+#define CLEMULATOR_OPTIMIZER_H
+
+#include "clemulator.h"
+
+/* rewrites run on the stages of a parsed plan before it is executed */
+void log_stage(const char* prefix, char* stage[]);
+int is_stage(char* stage[], const char* cmd, int argc);
+int are_stages_equal(char* first[], char* second[]);
+int is_idempotent_filter(char* stage[]);
+long head_count(char* stage[]);
+int inverted_grep_patterns(char* stage[], char** mode);
+int is_same_mode(const char* first, const char* second);
+int append_patterns(char* grep[], int size, char* stage[], int start);
+void remove_stage(clem_plan* plan, int idx);
+int fold_leading_cat(clem_plan* plan, int log);
+int drop_identity_cats(clem_plan* plan, int log);
+int merge_adjacent_filters(clem_plan* plan, int log);
+char** merge_inverted_greps(clem_plan* plan, char* first[],
+                            int first_start, char* second[],
+                            int second_start);
+int optimize_pipeline(clem_plan* plan, int log);
+#endif
@@ -6,6 +6,18 @@
 #include "string_util.h"
 
 
+/* longer tokens go first so ">>" is not read as ">" */
+static list separator_nodes[] = { { ">>", &separator_nodes[1] },
+                                  { ">", &separator_nodes[2] },
+                                  { "<", &separator_nodes[3] },
+                                  { "&", &separator_nodes[4] },
+                                  { "|", NULL } };
+
+const list* default_separators()
+{
+    return separator_nodes;
+}
+
 enum separator_type identify_separator(char* separator)
 {
     if (separator == NULL)
@@ -90,7 +102,7 @@ void mutate_to_default(int* word_size, int* word_cap, int* quote_flag,
     *new_word_flag = 1;
 }
 
-list* tokenize_string(const char* str, list* separators)
+list* tokenize_string(const char* str, const list* separators)
 {
     list *head = NULL, *tail = NULL;
     int i, word_size, word_cap, quote_flag, new_word_flag;
@@ -128,10 +140,22 @@ list* tokenize_string(const char* str, list* separators)
     }
     if (quote_flag)
     {
-        fprintf(stderr, "Error - unbalanced quotes\n");
+        report_syntax_error("Error - unbalanced quotes");
         list_free(head);
         return NULL;
     }
     return head;
 }
 
+static __thread int quiet_syntax_errors = 0;
+
+void set_syntax_errors_quiet(int quiet)
+{
+    quiet_syntax_errors = quiet;
+}
+
+void report_syntax_error(const char* msg)
+{
+    if (!quiet_syntax_errors)
+        fprintf(stderr, "%s\n", msg);
+}
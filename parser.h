@@ -24,5 +24,9 @@ void update_word(int* new_word_flag, list** tail, list** head,
                  int* word_cap);
 void mutate_to_default(int* word_size, int* word_cap, int* quote_flag,
                        int* new_word_flag);
-list* tokenize_string(const char* str, list* separators);
+list* tokenize_string(const char* str, const list* separators);
+const list* default_separators();
+/* per thread, for lines parsed ahead and parsed again when they run */
+void set_syntax_errors_quiet(int quiet);
+void report_syntax_error(const char* msg);
 #endif
@@ -0,0 +1,181 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argv_util.h"
+#include "deadline.h"
+#include "function.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "plan.h"
+#include "process_util.h"
+#include "stats.h"
+
+int is_blank(const char* line)
+{
+    for (; line != NULL && *line != '\0'; line++)
+    {
+        if (!isspace(*line))
+            return 0;
+    }
+    return 1;
+}
+
+/* "timeout [-k GRACE] DURATION cmd ..." puts the whole line under a
+ * deadline, the prefix words stay owned by argv */
+int strip_timeout_prefix(clem_plan* plan)
+{
+    char** stage = plan->piped[0];
+    long timeout_ms, grace_ms = default_grace_ms;
+    int i = 1;
+    if (strcmp(stage[0], "timeout"))
+        return 0;
+    if (stage[i] != NULL && !strcmp(stage[i], "-k"))
+    {
+        if (parse_duration(stage[i + 1], &grace_ms) == -1)
+            i = -1;
+        else
+            i += 2;
+    }
+    if (i == -1 || parse_duration(stage[i], &timeout_ms) == -1
+        || stage[i + 1] == NULL)
+    {
+        report_syntax_error("Usage: timeout [-k GRACE] DURATION command");
+        return -1;
+    }
+    plan->modifier.timeout_ms = timeout_ms;
+    plan->modifier.grace_ms = grace_ms;
+    plan->piped[0] = stage + i + 1;
+    return 0;
+}
+
+clem_plan* new_plan()
+{
+    clem_plan* plan;
+    plan = stats_malloc(sizeof(*plan));
+    plan->argv = NULL;
+    plan->argc = 0;
+    plan->piped = NULL;
+    plan->num_pipes = 0;
+    plan->extra_stages = NULL;
+    plan->num_extra_stages = 0;
+    plan->written = NULL;
+    plan->num_written = 0;
+    memset(&plan->bench, 0, sizeof(plan->bench));
+    plan->function_name = NULL;
+    plan->body = NULL;
+    plan->body_len = 0;
+    plan->refs = 1;
+    return plan;
+}
+
+/* flags are the clem_ctx_set_flags bits */
+clem_plan* parse_plan(const char* line, int flags)
+{
+    list* command;
+    clem_plan* plan;
+    int valid;
+    stats_timer timer;
+    if (is_function_definition(line))
+        return parse_function_definition(line, flags);
+    plan = new_plan();
+    stats_begin(&timer, stage_tokenize);
+    command = tokenize_string(line, default_separators());
+    plan->argv = list_to_argv(&command);
+    plan->argc = get_argc(plan->argv);
+    stats_end(&timer);
+    if (plan->argc == 0 && !is_blank(line))
+    {
+        free_plan(plan); /* unbalanced quotes */
+        return NULL;
+    }
+    if (plan->argc == 0)
+        return plan;
+    stats_begin(&timer, stage_validate);
+    valid = is_argv_valid(plan->argv);
+    if (valid)
+    {
+        plan->modifier = get_command_modifier(plan->argv);
+        unjunk_command(plan->argv, default_separators());
+        plan->num_pipes = count_pipes(plan->argv);
+        plan->piped = pipe_split_argv(plan->argv);
+        valid = (plan->num_pipes == 1
+                 || is_piped_valid(plan->piped, plan->num_pipes))
+            && strip_bench_prefix(plan) == 0
+            && strip_timeout_prefix(plan) == 0;
+    }
+    stats_end(&timer);
+    if (!valid)
+    {
+        free_plan(plan);
+        return NULL;
+    }
+    if (plan->num_pipes > 1 && !(flags & clem_no_pipe_optimizer))
+    {
+        plan->extra_stages
+            = stats_malloc(plan->num_pipes * sizeof(*plan->extra_stages));
+        plan->written
+            = stats_malloc(plan->num_pipes * sizeof(*plan->written));
+        memcpy(plan->written, plan->piped,
+               plan->num_pipes * sizeof(*plan->written));
+        plan->num_written = plan->num_pipes;
+        plan->written_modifier = plan->modifier;
+        if (optimize_pipeline(plan, flags & clem_log_rewrites) == 0)
+        {
+            free(plan->written);
+            plan->written = NULL;
+        }
+    }
+    return plan;
+}
+
+/* the optimizer leaves builtins alone, but functions are only known
+ * once their definitions ran: a pipeline calling one runs as written */
+int select_stages(const clem_ctx* ctx, const clem_plan* plan,
+                  char**** piped, command_modifier* cmd_mod)
+{
+    int i;
+    *piped = plan->piped;
+    *cmd_mod = plan->modifier;
+    if (plan->written == NULL)
+        return plan->num_pipes;
+    for (i = 0; i < plan->num_written; i++)
+    {
+        if (find_builtin(ctx, plan->written[i][0]) != NULL)
+        {
+            *piped = plan->written;
+            *cmd_mod = plan->written_modifier;
+            return plan->num_written;
+        }
+    }
+    return plan->num_pipes;
+}
+
+/* plans are immutable, so holders only ever share them */
+clem_plan* retain_plan(const clem_plan* plan)
+{
+    clem_plan* held = (clem_plan*)plan;
+    __sync_fetch_and_add(&held->refs, 1);
+    return held;
+}
+
+void free_plan(clem_plan* plan)
+{
+    int i;
+    if (plan == NULL || __sync_sub_and_fetch(&plan->refs, 1) > 0)
+        return;
+    for (i = 0; i < plan->body_len; i++)
+        free_plan(plan->body[i]);
+    free(plan->body);
+    free(plan->function_name);
+    for (i = 0; i < plan->argc; i++)
+        free(plan->argv[i]);
+    for (i = 0; i < plan->num_extra_stages; i++)
+        free(plan->extra_stages[i]);
+    free(plan->extra_stages);
+    free(plan->written);
+    free(plan->argv);
+    free(plan->piped);
+    free(plan);
+}
@@ -0,0 +1,37 @@
+#ifndef CLEMULATOR_PLAN_H
+#define CLEMULATOR_PLAN_H
+
+#include "argv_util.h"
+#include "bench.h"
+#include "clemulator.h"
+
+/* a tokenized and validated command line, split into pipeline stages */
+struct clem_plan
+{
+    char** argv; /* owns the words, separators are cut out as NULLs */
+    int argc;    /* slots in argv including the cut ones */
+    char*** piped;
+    int num_pipes; /* 0 for an empty line */
+    command_modifier modifier;
+    char*** extra_stages; /* stage arrays built by the optimizer */
+    int num_extra_stages;
+    char*** written; /* the stages before any rewrite, NULL if none */
+    int num_written;
+    command_modifier written_modifier;
+    bench_options bench; /* set by the "bench" prefix */
+    char* function_name; /* set for a "name() { ... }" definition */
+    clem_plan** body;    /* its ';'-separated commands */
+    int body_len;
+    int refs; /* the caller's and those of functions defined by it */
+};
+
+int is_blank(const char* line);
+int strip_timeout_prefix(clem_plan* plan);
+clem_plan* new_plan();
+clem_plan* parse_plan(const char* line, int flags);
+clem_plan* retain_plan(const clem_plan* plan);
+int select_stages(const clem_ctx* ctx, const clem_plan* plan,
+                  char**** piped, command_modifier* cmd_mod);
+/* drops one reference, the plan goes with the last one */
+void free_plan(clem_plan* plan);
+#endif
@@ -1,27 +1,33 @@
+#define _GNU_SOURCE /* wait4, pipe2 */
+
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "argv_util.h"
+#include "bench.h"
+#include "context.h"
+#include "deadline.h"
+#include "function.h"
+#include "redirect_cache.h"
+#include "plan.h"
+#include "process_util.h"
+#include "stats.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
 
-/* action on signal SIGCHLD */
-void remove_zombies(int n)
-{
-    while (waitpid(-1, NULL, WNOHANG) > 0)
-        ;
-}
-
 int perform_redirect(char* filename, int strem_fd, int flags)
 {
     int fd;
@@ -41,6 +47,20 @@ int perform_redirect(char* filename, int strem_fd, int flags)
     return 0;
 }
 
+/* installs caller-supplied descriptors as the standard streams */
+int perform_std_fds(command_modifier cmd_mod)
+{
+    int i, fds[3];
+    fds[0] = cmd_mod.in_fd, fds[1] = cmd_mod.out_fd,
+    fds[2] = cmd_mod.err_fd;
+    for (i = 0; i < 3; i++)
+    {
+        if (fds[i] != -1 && fds[i] != i && dup2(fds[i], i) == -1)
+            return -1;
+    }
+    return 0;
+}
+
 int check_and_perform_redirect(char* argv[], command_modifier cmd_mod)
 {
     int success = 1;
@@ -66,86 +86,325 @@ int check_and_perform_redirect(char* argv[], command_modifier cmd_mod)
     return success ? 0 : -1;
 }
 
-void perform_cd_command(const char* dir)
+int perform_cd_command(const char* dir, FILE* err)
 {
     int err_code;
     if (dir == NULL)
     {
-        fprintf(stderr, "Argument expected\n");
-        return;
+        fprintf(err, "Argument expected\n");
+        return 1;
     }
     err_code = chdir(dir);
     if (err_code)
-        perror(dir);
+        fprintf(err, "%s: %s\n", dir, strerror(errno));
+    return err_code ? 1 : 0;
+}
+
+int perform_cd_builtin(char* argv[], FILE* out, FILE* err)
+{
+    return perform_cd_command(argv[1], err);
+}
+
+static const builtin builtins[]
+    = { { "cd", perform_cd_builtin, NULL },
+        { "stats", perform_stats_command, NULL },
+        { NULL, NULL, NULL } };
+
+/* the fixed builtins, then the functions defined in ctx */
+const builtin* find_builtin(const clem_ctx* ctx, const char* name)
+{
+    const builtin* b;
+    int i;
+    for (b = builtins; name != NULL && b->name != NULL; b++)
+    {
+        if (!strcmp(b->name, name))
+            return b;
+    }
+    for (i = 0; ctx != NULL && name != NULL && i < ctx->num_functions; i++)
+    {
+        if (!strcmp(ctx->functions[i].name, name))
+            return &ctx->functions[i];
+    }
+    return NULL;
+}
+
+/* duplicates fd close-on-exec, so that children forked by other
+ * threads meanwhile do not get it */
+static FILE* open_stream_copy(int fd, FILE* fallback)
+{
+    FILE* stream;
+    if (fd == -1 || (fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1)
+        return fallback;
+    if ((stream = fdopen(fd, "w")) == NULL)
+    {
+        close(fd);
+        return fallback;
+    }
+    return stream;
+}
+
+FILE* open_builtin_errors(command_modifier cmd_mod)
+{
+    return open_stream_copy(cmd_mod.err_fd, stderr);
+}
+
+/* builtins run in the shell itself, so their output honours the
+ * redirection or the caller's descriptor here instead of in a child,
+ * opened the way check_and_perform_redirect opens it for a child */
+FILE* open_builtin_output(command_modifier cmd_mod, FILE* err)
+{
+    FILE* out;
+    int fd, flags;
+    if (cmd_mod.redirect_out != NULL)
+    {
+        flags = cmd_mod.append ? O_WRONLY | O_APPEND | O_BINARY
+                               : O_WRONLY | O_CREAT | O_TRUNC | O_BINARY;
+        fd = open(cmd_mod.redirect_out, flags | O_CLOEXEC, 0666);
+        if (fd == -1 || (out = fdopen(fd, "w")) == NULL)
+        {
+            fprintf(err, "%s: %s\n", cmd_mod.redirect_out,
+                    strerror(errno));
+            if (fd != -1)
+                close(fd);
+            return NULL;
+        }
+        return out;
+    }
+    return open_stream_copy(cmd_mod.out_fd, stdout);
+}
+
+int perform_builtin(clem_ctx* ctx, const builtin* b, char* argv[],
+                    command_modifier cmd_mod, struct rusage* usage)
+{
+    FILE *out, *err;
+    int status;
+    if (b->function != NULL)
+        return call_function(ctx, b, argv, cmd_mod, usage);
+    err = open_builtin_errors(cmd_mod);
+    out = open_builtin_output(cmd_mod, err);
+    if (out == NULL)
+    {
+        if (err != stderr)
+            fclose(err);
+        return 1;
+    }
+    status = b->handler(argv, out, err);
+    if (err != stderr)
+        fclose(err);
+    if (b->handler == perform_cd_builtin)
+        flush_redirect_cache(ctx);
+    if (out != stdout)
+        fclose(out);
+    else
+        fflush(stdout);
+    return status;
+}
+
+/* moves the terminal's foreground to pgid, SIGTTOU is held off since
+ * the caller may not be in the foreground group any more */
+void hand_terminal(int pgid)
+{
+    sigset_t ttou_mask, old_mask;
+    sigemptyset(&ttou_mask);
+    sigaddset(&ttou_mask, SIGTTOU);
+    pthread_sigmask(SIG_BLOCK, &ttou_mask, &old_mask);
+    tcsetpgrp(0, pgid);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 }
 
-void perform_command_w_pid(char* argv[], int pid, command_modifier cmd_mod)
+/* called on both sides of fork() so neither can run ahead of it */
+void join_process_group(int pid, command_modifier cmd_mod)
 {
+    if (cmd_mod.pgid == -1)
+        return;
+    setpgid(pid, cmd_mod.pgid);
+    if (cmd_mod.take_terminal && cmd_mod.pgid == 0)
+        hand_terminal(pid ? pid : getpid());
+}
+
+/* a builtin in a child, such as a function in a pipeline, runs there
+ * as in a subshell once the streams are in place */
+void perform_command_w_pid(clem_ctx* ctx, char* argv[], int pid,
+                           command_modifier cmd_mod)
+{
+    const builtin* b;
     if (!pid)
     {
-        if (check_and_perform_redirect(argv, cmd_mod) == -1)
+        join_process_group(0, cmd_mod);
+        if (perform_std_fds(cmd_mod) == -1
+            || check_and_perform_redirect(argv, cmd_mod) == -1)
         {
             fprintf(stderr, "Cannot perform redirection\n");
-            exit(1);
+            _exit(1);
+        }
+        if (find_builtin(ctx, argv[0]) != NULL)
+        {
+            /* the parent's jobs, deadlines and timerfd are not ours */
+            ctx = context_for_child(ctx);
+            b = find_builtin(ctx, argv[0]);
+            _exit(perform_builtin(ctx, b, argv,
+                                  get_command_modifier(argv), NULL));
         }
         execvp(argv[0], argv);
         perror(argv[0]);
-        exit(1);
+        _exit(1);
     }
 }
 
-void perform_single_command(char** argv, command_modifier cmd_mod)
+/* shell-style exit code of a wait() status */
+int decode_wait_status(int status)
+{
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+void add_rusage(struct rusage* sum, const struct rusage* add)
+{
+    sum->ru_utime.tv_sec += add->ru_utime.tv_sec;
+    sum->ru_utime.tv_usec += add->ru_utime.tv_usec;
+    sum->ru_stime.tv_sec += add->ru_stime.tv_sec;
+    sum->ru_stime.tv_usec += add->ru_stime.tv_usec;
+    sum->ru_utime.tv_sec += sum->ru_utime.tv_usec / 1000000;
+    sum->ru_utime.tv_usec %= 1000000;
+    sum->ru_stime.tv_sec += sum->ru_stime.tv_usec / 1000000;
+    sum->ru_stime.tv_usec %= 1000000;
+    if (add->ru_maxrss > sum->ru_maxrss)
+        sum->ru_maxrss = add->ru_maxrss;
+    sum->ru_minflt += add->ru_minflt;
+    sum->ru_majflt += add->ru_majflt;
+    sum->ru_nvcsw += add->ru_nvcsw;
+    sum->ru_nivcsw += add->ru_nivcsw;
+}
+
+/* waits for one specific child so other children of the process are
+ * never reaped by mistake */
+int wait_child(int pid, struct rusage* usage)
+{
+    int status = 0;
+    struct rusage child_usage;
+    while (wait4(pid, &status, 0, &child_usage) == -1)
+    {
+        if (errno != EINTR)
+            return 1;
+    }
+    if (usage != NULL)
+        add_rusage(usage, &child_usage);
+    return decode_wait_status(status);
+}
+
+int perform_single_command(clem_ctx* ctx, char** argv,
+                           command_modifier cmd_mod, struct rusage* usage)
 {
     int pid;
-    if (argv_contains(argv, "cd") == 0)
-        perform_cd_command(argv[1]);
-    else
+    const builtin* b;
+    stats_timer timer;
+    /* a function only needs a process of its own to be put in the
+     * background or under a deadline */
+    if ((b = find_builtin(ctx, argv[0])) != NULL
+        && (b->function == NULL
+            || (!cmd_mod.is_daemon && cmd_mod.timeout_ms <= 0)))
+        return perform_builtin(ctx, b, argv, cmd_mod, usage);
+    stats_begin(&timer, stage_fork);
+    pid = fork();
+    perform_command_w_pid(ctx, argv, pid, cmd_mod);
+    stats_end(&timer);
+    if (pid == -1)
     {
-        pid = fork();
-        perform_command_w_pid(argv, pid, cmd_mod);
-        if (!cmd_mod.is_daemon)
-            while (wait(NULL) != pid)
-                ;
+        perror("fork");
+        return 1;
     }
+    join_process_group(pid, cmd_mod);
+    return finish_job(ctx, &pid, 1, cmd_mod, usage);
 }
 
-int wait_pid_arr(int* pids, int size)
+/* returns the exit code of the last pid in the array */
+int wait_pid_arr(int* pids, int size, struct rusage* usage)
 {
-    int i, term_pid, not_finished = 0;
-    term_pid = wait(NULL);
+    int i, status = 0;
     for (i = 0; i < size; i++)
     {
-        pids[i] = (pids[i] == term_pid ? -1 : pids[i]);
         if (pids[i] != -1)
-            not_finished = 1;
+            status = wait_child(pids[i], usage);
+    }
+    return status;
+}
+
+/* waits for the forked stages or hands them over to the context as a
+ * background job, registering the deadline of the command if it has
+ * one; returns the exit code of the last stage */
+int finish_job(clem_ctx* ctx, int* pids, int size,
+               command_modifier cmd_mod, struct rusage* usage)
+{
+    int i, status;
+    stats_timer timer;
+    if (cmd_mod.is_daemon)
+    {
+        for (i = 0; i < size; i++)
+        {
+            if (pids[i] != -1)
+                add_background_job(ctx, pids[i],
+                                   cmd_mod.pgid == -1 ? -1 : pids[0]);
+        }
+        if (cmd_mod.timeout_ms > 0 && pids[0] != -1)
+            add_deadline(ctx, pids[0], cmd_mod.timeout_ms,
+                         cmd_mod.grace_ms);
+        return 0;
     }
-    return not_finished;
+    stats_begin(&timer, stage_wait);
+    /* background deadlines are due while we wait, not after */
+    if ((cmd_mod.timeout_ms > 0 || ctx->num_deadlines > 0)
+        && pids[0] != -1)
+        status = wait_pids_with_deadline(ctx, pids, size,
+                                         cmd_mod.timeout_ms,
+                                         cmd_mod.grace_ms, usage);
+    else
+        status = wait_pid_arr(pids, size, usage);
+    stats_end(&timer);
+    if (cmd_mod.take_terminal)
+        hand_terminal(getpgrp());
+    return status;
 }
 
 /* unhandled cd */
-void perform_pipe(char*** piped, int num_pipes, command_modifier cmd_mod)
+int perform_pipe(clem_ctx* ctx, char*** piped, int num_pipes,
+                 command_modifier cmd_mod, struct rusage* usage)
 {
     int* pids;
     int fd[2];
-    int saved_fd = -1, i;
-    pids = malloc(num_pipes * sizeof(*pids));
+    int saved_fd = -1, i, status;
+    command_modifier leader_mod;
+    stats_timer timer;
+    pids = stats_malloc(num_pipes * sizeof(*pids));
+    leader_mod = cmd_mod;
     for (i = 0; i < num_pipes - 1; i++)
     {
-        pipe(fd);
-        if ((pids[i] = fork()) == 0)
+        /* close-on-exec keeps the ends out of children forked by other
+         * threads, dup2 clears it on the copies a stage really uses */
+        pipe2(fd, O_CLOEXEC);
+        stats_begin(&timer, stage_fork);
+        pids[i] = fork();
+        stats_end(&timer);
+        if (pids[i] > 0)
+            join_process_group(pids[i], cmd_mod);
+        if (i == 0 && cmd_mod.pgid == 0 && pids[0] > 0)
+            cmd_mod.pgid = pids[0]; /* later stages join the first */
+        if (pids[i] == 0)
         {
             cmd_mod.redirect_out = NULL;
+            cmd_mod.out_fd = -1;
             close(fd[0]);
             if (i != 0)
             {
                 dup2(saved_fd, 0);
                 close(saved_fd);
                 cmd_mod.redirect_in = NULL;
+                cmd_mod.in_fd = -1;
             }
             dup2(fd[1], 1);
-            perform_command_w_pid(piped[i], pids[i], cmd_mod);
+            perform_command_w_pid(ctx, piped[i], pids[i], cmd_mod);
             perror(piped[i][0]);
-            exit(1);
+            _exit(1);
         }
         if (saved_fd != -1)
         {
@@ -154,37 +413,63 @@ void perform_pipe(char*** piped, int num_pipes, command_modifier cmd_mod)
         saved_fd = fd[0];
         close(fd[1]);
     }
-    if ((pids[num_pipes - 1] = fork()) == 0)
+    stats_begin(&timer, stage_fork);
+    pids[num_pipes - 1] = fork();
+    stats_end(&timer);
+    if (pids[num_pipes - 1] > 0)
+        join_process_group(pids[num_pipes - 1], cmd_mod);
+    if (pids[num_pipes - 1] == 0)
     {
-        close(fd[1]);
         dup2(saved_fd, 0);
         cmd_mod.redirect_in = NULL;
-        perform_command_w_pid(piped[num_pipes - 1], pids[num_pipes - 1],
-                              cmd_mod);
+        cmd_mod.in_fd = -1;
+        perform_command_w_pid(ctx, piped[num_pipes - 1],
+                              pids[num_pipes - 1], cmd_mod);
         perror(piped[num_pipes - 1][0]);
-        exit(1);
+        _exit(1);
     }
-    close(fd[0]);
-    close(fd[1]);
     close(saved_fd);
-    if (!cmd_mod.is_daemon)
-    {
-        while (wait_pid_arr(pids, num_pipes))
-            ;
-    }
+    status = finish_job(ctx, pids, num_pipes, leader_mod, usage);
     free(pids);
+    return status;
 }
 
-/* assumes argv is valid */
-void perform_command(char* argv[], command_modifier cmd_mod)
+/* returns the exit code of the last stage, std_fds may be NULL */
+int perform_command(clem_ctx* ctx, const clem_plan* plan,
+                    const int std_fds[3], struct rusage* usage)
 {
+    command_modifier cmd_mod;
     char*** piped;
     int num_pipes;
-    num_pipes = count_pipes(argv);
-    piped = pipe_split_argv(argv);
+    if (plan->function_name != NULL)
+        return define_function(ctx, plan);
+    if (plan->num_pipes == 0)
+        return 0;
+    if (plan->bench.runs > 0)
+        return perform_bench(ctx, plan, std_fds);
+    num_pipes = select_stages(ctx, plan, &piped, &cmd_mod);
+    if (std_fds != NULL)
+    {
+        cmd_mod.in_fd = std_fds[0];
+        cmd_mod.out_fd = std_fds[1];
+        cmd_mod.err_fd = std_fds[2];
+    }
+    if (ctx->flags & clem_cache_appends)
+        use_cached_redirect(ctx, &cmd_mod);
+    if (cmd_mod.timeout_ms < 0)
+    {
+        cmd_mod.timeout_ms = ctx->default_timeout_ms;
+        cmd_mod.grace_ms = ctx->default_grace_ms;
+    }
+    /* a deadline signals the whole pipeline through its own group,
+     * which then has to own the terminal while in the foreground */
+    if (cmd_mod.timeout_ms > 0)
+    {
+        cmd_mod.pgid = 0;
+        cmd_mod.take_terminal = !cmd_mod.is_daemon && cmd_mod.in_fd == -1
+            && isatty(0) && tcgetpgrp(0) == getpgrp();
+    }
     if (num_pipes == 1)
-        perform_single_command(piped[0], cmd_mod);
-    else if (is_piped_valid(piped, num_pipes))
-        perform_pipe(piped, num_pipes, cmd_mod);
-    free(piped);
+        return perform_single_command(ctx, piped[0], cmd_mod, usage);
+    return perform_pipe(ctx, piped, num_pipes, cmd_mod, usage);
 }
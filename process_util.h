@@ -1,13 +1,45 @@
 #ifndef CLEMULATOR_PROCESS_UTIL
 #define CLEMULATOR_PROCESS_UTIL
-void remove_zombies(int n);
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "argv_util.h"
+#include "clemulator.h"
+
+typedef struct builtin
+{
+    const char* name;
+    int (*handler)(char* argv[], FILE* out, FILE* err);
+    clem_plan* function; /* body of a shell function, no handler then */
+} builtin;
+
 int perform_redirect(char* filename, int strem_fd, int flags);
+int perform_std_fds(command_modifier cmd_mod);
 int check_and_perform_redirect(char* argv[], command_modifier cmd_mod);
-void perform_cd_command(const char* dir);
-void perform_command_w_pid(char* argv[], int pid, command_modifier cmd_mod);
-void perform_single_command(char** argv, command_modifier cmd_mod);
-int wait_pid_arr(int* pids, int size);
-void perform_pipe(char*** piped, int num_pipes, command_modifier cmd_mod);
-void perform_command(char* argv[], command_modifier cmd_mod);
+int perform_cd_command(const char* dir, FILE* err);
+int perform_cd_builtin(char* argv[], FILE* out, FILE* err);
+/* ctx may be NULL for the builtins every context has */
+const builtin* find_builtin(const clem_ctx* ctx, const char* name);
+FILE* open_builtin_errors(command_modifier cmd_mod);
+FILE* open_builtin_output(command_modifier cmd_mod, FILE* err);
+int perform_builtin(clem_ctx* ctx, const builtin* b, char* argv[],
+                    command_modifier cmd_mod, struct rusage* usage);
+void hand_terminal(int pgid);
+void join_process_group(int pid, command_modifier cmd_mod);
+void perform_command_w_pid(clem_ctx* ctx, char* argv[], int pid,
+                           command_modifier cmd_mod);
+int decode_wait_status(int status);
+void add_rusage(struct rusage* sum, const struct rusage* add);
+int wait_child(int pid, struct rusage* usage);
+int perform_single_command(clem_ctx* ctx, char** argv,
+                           command_modifier cmd_mod, struct rusage* usage);
+int wait_pid_arr(int* pids, int size, struct rusage* usage);
+int finish_job(clem_ctx* ctx, int* pids, int size,
+               command_modifier cmd_mod, struct rusage* usage);
+int perform_pipe(clem_ctx* ctx, char*** piped, int num_pipes,
+                 command_modifier cmd_mod, struct rusage* usage);
+int perform_command(clem_ctx* ctx, const clem_plan* plan,
+                    const int std_fds[3], struct rusage* usage);
 
 #endif
@@ -0,0 +1,191 @@
+#define _GNU_SOURCE /* eventfd */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "clemulator.h"
+#include "parser.h"
+#include "readahead.h"
+#include "stats.h"
+#include "string_util.h"
+
+/* the scan stage starts once the first character is there, so waiting
+ * for the user or the pipe to deliver a line is not counted; only a
+ * line longer than the stdio buffer can still wait for a refill */
+char* scan_command(FILE* in)
+{
+    int symbol;
+    int size = 0;
+    int capacity = default_string_cap;
+    char* command_str = NULL;
+    stats_timer timer;
+    symbol = getc(in);
+    stats_begin(&timer, stage_scan);
+    for (; symbol != EOF && symbol != '\n'; symbol = getc(in))
+        command_str = update_str(command_str, symbol, &size, &capacity);
+    stats_end(&timer);
+    return command_str;
+}
+
+/* the index the other side writes, acquire pairs with its store */
+static unsigned long load_index(unsigned long* index)
+{
+    return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+/* seq_cst so the flag check that follows cannot pass it */
+static void publish_index(unsigned long* index, unsigned long value)
+{
+    __atomic_store_n(index, value, __ATOMIC_SEQ_CST);
+}
+
+static void raise_flag(int* sleeping)
+{
+    __atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+}
+
+static void clear_flag(int* sleeping)
+{
+    __atomic_store_n(sleeping, 0, __ATOMIC_SEQ_CST);
+}
+
+/* wakes the other side if it raised its flag, one write per sleep */
+static void wake(int* sleeping, int fd)
+{
+    eventfd_t one = 1;
+    int raised = 1;
+    if (!__atomic_load_n(sleeping, __ATOMIC_SEQ_CST)
+        || !__atomic_compare_exchange_n(sleeping, &raised, 0, 0,
+                                        __ATOMIC_SEQ_CST,
+                                        __ATOMIC_SEQ_CST))
+        return;
+    while (write(fd, &one, sizeof(one)) == -1 && errno == EINTR)
+        ;
+}
+
+static void push_line(readahead* ra, clem_plan* plan, char* line)
+{
+    readahead_line* slot;
+    eventfd_t count;
+    while (ra->head - load_index(&ra->tail) == readahead_slots)
+    {
+        raise_flag(&ra->producer_sleeping);
+        if (ra->head - __atomic_load_n(&ra->tail, __ATOMIC_SEQ_CST)
+            != readahead_slots)
+        {
+            clear_flag(&ra->producer_sleeping);
+            break;
+        }
+        /* a wakeup left over from a sleep that did not happen only
+         * costs one more pass */
+        if (read(ra->drained, &count, sizeof(count)) == -1
+            && errno != EINTR)
+            break;
+    }
+    slot = &ra->ring[ra->head % readahead_slots];
+    slot->plan = plan;
+    slot->line = line;
+    publish_index(&ra->head, ra->head + 1);
+    wake(&ra->consumer_sleeping, ra->filled);
+}
+
+/* returns once the ring holds a line, 0 on success */
+static int wait_filled(readahead* ra)
+{
+    struct pollfd fds[2];
+    eventfd_t count;
+    fds[0].fd = ra->filled;
+    fds[0].events = POLLIN;
+    for (;;)
+    {
+        if (load_index(&ra->head) != ra->tail)
+            return 0;
+        raise_flag(&ra->consumer_sleeping);
+        if (__atomic_load_n(&ra->head, __ATOMIC_SEQ_CST) != ra->tail)
+        {
+            clear_flag(&ra->consumer_sleeping);
+            return 0;
+        }
+        fds[1].fd = clem_timer_fd(ra->ctx); /* created by a later line */
+        fds[1].events = POLLIN;
+        if (poll(fds, fds[1].fd != -1 ? 2 : 1, -1) == -1 && errno != EINTR)
+            return -1;
+        if (fds[0].revents & POLLIN)
+            (void)read(ra->filled, &count, sizeof(count));
+        if (fds[1].fd != -1 && (fds[1].revents & POLLIN))
+            clem_dispatch(ra->ctx);
+    }
+}
+
+/* parsing is purely lexical, nothing in a plan depends on the working
+ * directory or on what earlier lines did, so it may run ahead */
+static void* parse_ahead(void* arg)
+{
+    readahead* ra = arg;
+    clem_plan* plan;
+    char* line;
+    set_syntax_errors_quiet(1);
+    while (!feof(ra->in))
+    {
+        line = scan_command(ra->in);
+        if (line == NULL)
+            continue; /* empty lines do not even change the status */
+        plan = clem_parse(ra->ctx, line);
+        if (plan != NULL)
+        {
+            free(line);
+            line = NULL;
+        }
+        push_line(ra, plan, line);
+    }
+    push_line(ra, NULL, NULL);
+    return NULL;
+}
+
+int readahead_start(readahead* ra, clem_ctx* ctx, FILE* in)
+{
+    ra->ctx = ctx;
+    ra->in = in;
+    ra->head = 0;
+    ra->tail = 0;
+    ra->consumer_sleeping = 0;
+    ra->producer_sleeping = 0;
+    ra->filled = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ra->filled == -1)
+        return -1;
+    ra->drained = eventfd(0, EFD_CLOEXEC);
+    if (ra->drained == -1)
+    {
+        close(ra->filled);
+        return -1;
+    }
+    if (pthread_create(&ra->thread, NULL, parse_ahead, ra) != 0)
+    {
+        close(ra->filled);
+        close(ra->drained);
+        return -1;
+    }
+    return 0;
+}
+
+int readahead_next(readahead* ra, readahead_line* next)
+{
+    if (wait_filled(ra) == -1)
+        return 0;
+    *next = ra->ring[ra->tail % readahead_slots];
+    publish_index(&ra->tail, ra->tail + 1);
+    wake(&ra->producer_sleeping, ra->drained);
+    return next->plan != NULL || next->line != NULL;
+}
+
+void readahead_stop(readahead* ra)
+{
+    pthread_join(ra->thread, NULL);
+    close(ra->filled);
+    close(ra->drained);
+}
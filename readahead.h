@@ -0,0 +1,56 @@
+#ifndef CLEMULATOR_READAHEAD_H
+#define CLEMULATOR_READAHEAD_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "clemulator.h"
+
+enum
+{
+    readahead_slots = 64 /* lines parsed ahead of the running one */
+};
+
+/* a script line in the order it was read; plan is NULL when the line
+ * does not parse, the executor then parses line again so that the error
+ * shows up after the output of the lines before it. Both NULL at EOF */
+typedef struct readahead_line
+{
+    clem_plan* plan;
+    char* line;
+} readahead_line;
+
+/* bounded single-producer single-consumer ring without locks: head is
+ * written by the parsing thread only and tail by the executor only, the
+ * store of an index is ordered after the slot accesses it publishes. A
+ * side that finds the ring empty (or full) raises its sleeping flag,
+ * looks again and only then blocks on its eventfd; the other side
+ * writes that eventfd only when it clears the flag, so a line costs no
+ * system call while both keep up. The executor polls filled along with
+ * the deadline timer.
+ *
+ * The parse stages are counted by the parsing thread when it gets to a
+ * line, so stats and stats --reset include the tokenize and validate
+ * work of up to readahead_slots lines that have not run yet */
+typedef struct readahead
+{
+    clem_ctx* ctx;
+    FILE* in;
+    readahead_line ring[readahead_slots];
+    unsigned long head;
+    unsigned long tail;
+    int consumer_sleeping;
+    int producer_sleeping;
+    int filled;
+    int drained;
+    pthread_t thread;
+} readahead;
+
+char* scan_command(FILE* in);
+int readahead_start(readahead* ra, clem_ctx* ctx, FILE* in);
+/* blocks until the next line is parsed, dispatching the context's
+ * deadlines meanwhile; returns 0 at the end of input */
+int readahead_next(readahead* ra, readahead_line* next);
+/* only after readahead_next returned 0 */
+void readahead_stop(readahead* ra);
+#endif
@@ -0,0 +1,120 @@
+#define _POSIX_C_SOURCE 200809L /* O_CLOEXEC */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "context.h"
+#include "function.h"
+#include "redirect_cache.h"
+
+/* Appending scripts redirect to the same few files over and over. The
+ * shell keeps those open (close-on-exec) and hands the descriptor to the
+ * command as its stdout, so a line costs a stat() of the path instead of
+ * an open() and close() in the child. Only ">>" is cached: ">" has to
+ * truncate the file on every command anyway. */
+
+static void drop_entry(cached_redirect* entry)
+{
+    close(entry->fd);
+    free(entry->path);
+    entry->path = NULL;
+}
+
+static cached_redirect* find_entry(clem_ctx* ctx, const char* path)
+{
+    int i;
+    for (i = 0; i < redirect_cache_size; i++)
+    {
+        if (ctx->redirects[i].path != NULL
+            && !strcmp(ctx->redirects[i].path, path))
+            return &ctx->redirects[i];
+    }
+    return NULL;
+}
+
+/* a free slot or the least recently used one */
+static cached_redirect* victim_entry(clem_ctx* ctx)
+{
+    cached_redirect* victim = &ctx->redirects[0];
+    int i;
+    for (i = 0; i < redirect_cache_size; i++)
+    {
+        if (ctx->redirects[i].path == NULL)
+            return &ctx->redirects[i];
+        if (ctx->redirects[i].last_used < victim->last_used)
+            victim = &ctx->redirects[i];
+    }
+    drop_entry(victim);
+    return victim;
+}
+
+/* -1 when the file cannot be opened, the child then tries on its own
+ * and reports the error; like an uncached ">>" this never creates it.
+ * Only regular files are kept: opening a FIFO blocks until a reader
+ * comes, which has to be the child and not the shell */
+int cached_append_fd(clem_ctx* ctx, const char* path)
+{
+    cached_redirect* entry;
+    struct stat st;
+    int fd;
+    entry = find_entry(ctx, path);
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+    {
+        if (entry != NULL)
+            drop_entry(entry);
+        return -1;
+    }
+    if (entry != NULL && entry->dev == st.st_dev
+        && entry->ino == st.st_ino)
+    {
+        entry->last_used = ++ctx->redirect_clock;
+        return entry->fd;
+    }
+    if (entry != NULL)
+        drop_entry(entry); /* renamed or replaced since */
+    /* O_NONBLOCK in case a FIFO took the file's place since the stat,
+     * the child gets the descriptor back in blocking mode */
+    fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC | O_NONBLOCK);
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)
+        || fcntl(fd, F_SETFL, O_APPEND) == -1)
+    {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    entry = victim_entry(ctx);
+    entry->path = copy_word(path);
+    entry->fd = fd;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->last_used = ++ctx->redirect_clock;
+    return fd;
+}
+
+/* turns an ">>" of cmd_mod into its cached descriptor when there is one */
+void use_cached_redirect(clem_ctx* ctx, command_modifier* cmd_mod)
+{
+    int fd;
+    if (cmd_mod->redirect_out == NULL || !cmd_mod->append)
+        return;
+    fd = cached_append_fd(ctx, cmd_mod->redirect_out);
+    if (fd == -1)
+        return;
+    cmd_mod->out_fd = fd;
+    cmd_mod->redirect_out = NULL;
+}
+
+/* relative paths mean other files after "cd" */
+void flush_redirect_cache(clem_ctx* ctx)
+{
+    int i;
+    for (i = 0; i < redirect_cache_size; i++)
+    {
+        if (ctx->redirects[i].path != NULL)
+            drop_entry(&ctx->redirects[i]);
+    }
+}
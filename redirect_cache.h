@@ -0,0 +1,28 @@
+#ifndef CLEMULATOR_REDIRECT_CACHE_H
+#define CLEMULATOR_REDIRECT_CACHE_H
+
+#include <sys/types.h>
+
+#include "argv_util.h"
+#include "clemulator.h"
+
+enum
+{
+    redirect_cache_size = 8 /* append targets kept open per context */
+};
+
+/* an ">>" target opened by the shell, valid while path still names the
+ * same inode */
+typedef struct cached_redirect
+{
+    char* path; /* NULL for a free slot */
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    unsigned long last_used;
+} cached_redirect;
+
+int cached_append_fd(clem_ctx* ctx, const char* path);
+void use_cached_redirect(clem_ctx* ctx, command_modifier* cmd_mod);
+void flush_redirect_cache(clem_ctx* ctx);
+#endif
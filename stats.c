@@ -0,0 +1,140 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+typedef struct stage_stats
+{
+    unsigned long count;
+    unsigned long hist[stats_buckets];
+    unsigned long max_ns;
+    unsigned long allocs;
+    unsigned long alloc_bytes;
+} stage_stats;
+
+/* shared by all threads and updated atomically, the stage an
+ * allocation is charged to is tracked per thread */
+static stage_stats stages[stage_count];
+
+static const char* stage_names[stage_count]
+    = { "other", "scan", "tokenize", "validate", "fork", "wait" };
+
+#ifndef CLEM_NO_STATS
+static __thread enum stats_stage current_stage = stage_other;
+
+void stats_begin(stats_timer* timer, enum stats_stage stage)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    timer->sec = ts.tv_sec;
+    timer->nsec = ts.tv_nsec;
+    timer->stage = stage;
+    timer->prev_stage = current_stage;
+    current_stage = stage;
+}
+
+void stats_end(stats_timer* timer)
+{
+    struct timespec ts;
+    unsigned long ns, rest, max;
+    int bucket, octave;
+    stage_stats* st;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ns = (ts.tv_sec - timer->sec) * 1000000000L
+        + (ts.tv_nsec - timer->nsec);
+    /* below 16 ns every value has a bucket of its own, above that the
+     * top four bits pick the sub-bucket within the power of two */
+    octave = 0;
+    for (rest = ns; rest >= 2 * stats_sub_buckets; rest >>= 1)
+        octave++;
+    bucket = octave * stats_sub_buckets + (int)rest;
+    if (bucket >= stats_buckets)
+        bucket = stats_buckets - 1;
+    st = &stages[timer->stage];
+    __sync_fetch_and_add(&st->count, 1);
+    __sync_fetch_and_add(&st->hist[bucket], 1);
+    while (ns > (max = st->max_ns)
+           && !__sync_bool_compare_and_swap(&st->max_ns, max, ns))
+        ;
+    current_stage = timer->prev_stage;
+}
+
+void* stats_malloc(size_t size)
+{
+    __sync_fetch_and_add(&stages[current_stage].allocs, 1);
+    __sync_fetch_and_add(&stages[current_stage].alloc_bytes, size);
+    return malloc(size);
+}
+
+void* stats_realloc(void* ptr, size_t size)
+{
+    __sync_fetch_and_add(&stages[current_stage].allocs, 1);
+    __sync_fetch_and_add(&stages[current_stage].alloc_bytes, size);
+    return realloc(ptr, size);
+}
+#endif
+
+void stats_reset()
+{
+    memset(stages, 0, sizeof(stages));
+}
+
+/* upper bound of the bucket holding the given percentile, capped by max */
+static unsigned long stats_percentile(const stage_stats* st, int percent)
+{
+    unsigned long seen = 0, rank, bound, top;
+    int i;
+    if (st->count == 0)
+        return 0;
+    rank = (st->count * percent + 99) / 100;
+    for (i = 0; i < stats_buckets; i++)
+    {
+        seen += st->hist[i];
+        if (seen >= rank)
+            break;
+    }
+    /* the inverse of the bucketing in stats_end */
+    if (i < 2 * stats_sub_buckets)
+        bound = i;
+    else
+    {
+        top = stats_sub_buckets + i % stats_sub_buckets + 1;
+        bound = (top << (i / stats_sub_buckets - 1)) - 1;
+    }
+    return bound < st->max_ns ? bound : st->max_ns;
+}
+
+void stats_print(FILE* out)
+{
+    int i;
+    const stage_stats* st;
+    fprintf(out, "%-10s %10s %12s %12s %12s %10s %12s\n", "stage",
+            "count", "p50(us)", "p99(us)", "max(us)", "allocs", "bytes");
+    for (i = 0; i < stage_count; i++)
+    {
+        st = &stages[i];
+        fprintf(out, "%-10s %10lu %12.1f %12.1f %12.1f %10lu %12lu\n",
+                stage_names[i], st->count,
+                stats_percentile(st, 50) / 1000.0,
+                stats_percentile(st, 99) / 1000.0, st->max_ns / 1000.0,
+                st->allocs, st->alloc_bytes);
+    }
+}
+
+int perform_stats_command(char* argv[], FILE* out, FILE* err)
+{
+    if (argv[1] == NULL)
+        stats_print(out);
+    else if (!strcmp(argv[1], "--reset") && argv[2] == NULL)
+        stats_reset();
+    else
+    {
+        fprintf(err, "Usage: stats [--reset]\n");
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef CLEMULATOR_STATS_H
+#define CLEMULATOR_STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum stats_stage
+{
+    stage_other,
+    stage_scan,
+    stage_tokenize,
+    stage_validate,
+    stage_fork, /* the parent's fork() only, exec happens in the child
+                 * while the parent is already in stage_wait */
+    stage_wait,
+    stage_count
+};
+
+enum
+{
+    /* nanoseconds, each power of two split into stats_sub_buckets
+     * linear buckets so a percentile is off by at most 1/8, up to
+     * ~3 days */
+    stats_sub_buckets = 8,
+    stats_buckets = 46 * stats_sub_buckets
+};
+
+/* one sample in progress, lives on the caller's stack */
+typedef struct stats_timer
+{
+    long sec;
+    long nsec;
+    enum stats_stage stage;
+    enum stats_stage prev_stage;
+} stats_timer;
+
+/* building with -DCLEM_NO_STATS compiles the counters out, which is
+ * the baseline their overhead is measured against */
+#ifdef CLEM_NO_STATS
+#include <stdlib.h>
+#define stats_begin(timer, stage) ((void)(timer), (void)(stage))
+#define stats_end(timer) ((void)(timer))
+#define stats_malloc(size) malloc(size)
+#define stats_realloc(ptr, size) realloc(ptr, size)
+#else
+void stats_begin(stats_timer* timer, enum stats_stage stage);
+void stats_end(stats_timer* timer);
+void* stats_malloc(size_t size);
+void* stats_realloc(void* ptr, size_t size);
+#endif
+void stats_reset();
+void stats_print(FILE* out);
+int perform_stats_command(char* argv[], FILE* out, FILE* err);
+#endif
@@ -1,12 +1,14 @@
 #include <stdlib.h>
 
+#include "stats.h"
+
 /* str memory and input */
 char* reallocate_str(char* str, int size, int* capacity)
 {
     if (size + 1 == *capacity)
     {
         *capacity *= 2;
-        str = realloc(str, *capacity);
+        str = stats_realloc(str, *capacity);
     }
     return str;
 }
@@ -15,7 +17,7 @@ char* update_str(char* str, char symbol, int* size, int* capacity)
 {
     if (str == NULL) /* word is not initiated */
     {
-        str = malloc(*capacity);
+        str = stats_malloc(*capacity);
         *size = 0;
     }
     str = reallocate_str(str, *size, capacity);